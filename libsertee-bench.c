@@ -0,0 +1,355 @@
+/*
+ * libsertee-bench
+ * ----------
+ *
+ * microbenchmarks of the ring operations in libsertee, independent of FUSE
+ * and terminals. Every combination of the given reader counts, buffer sizes
+ * and chunk sizes is measured in ns per operation and, if perf_event is
+ * available, cache misses per operation.
+ *
+ * License: MPL-2.0
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "libsertee.h"
+
+#define MAX_LIST 32
+
+struct ringbench {
+	struct sertee_ring ring;
+	struct sertee_cursor *cursors;
+	size_t n_cursors;
+	size_t chunk;
+	char *data;
+	char *out;
+	
+	// next cursor for the operations that use one cursor at a time
+	size_t next;
+};
+
+struct ringbench_op {
+	const char *name;
+	const char *desc;
+	
+	// prepare the ring once before the measurement
+	void (*setup)(struct ringbench *rb);
+	// run n operations
+	void (*run)(struct ringbench *rb, uint64_t n);
+};
+
+static uint64_t bench_mono(void) {
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void publish_chunk(struct ringbench *rb) {
+	size_t n, pos;
+	char *dst;
+	
+	for (pos = 0; pos < rb->chunk; pos += n) {
+		dst = sertee_ring_reserve(&rb->ring, &n);
+		if (n > rb->chunk - pos)
+			n = rb->chunk - pos;
+		memcpy(dst, rb->data + pos, n);
+		sertee_ring_commit(&rb->ring, n);
+	}
+}
+
+static void read_chunk(struct ringbench *rb, struct sertee_cursor *cursor) {
+	const char *src;
+	size_t n, pos;
+	
+	for (pos = 0; pos < rb->chunk; pos += n) {
+		src = sertee_cursor_peek(cursor, &n);
+		if (n == 0)
+			break;
+		if (n > rb->chunk - pos)
+			n = rb->chunk - pos;
+		memcpy(rb->out + pos, src, n);
+		sertee_cursor_consume(cursor, n);
+	}
+}
+
+// every cursor has a chunk to read
+static void setup_filled(struct ringbench *rb) {
+	size_t i;
+	
+	for (i=0; i < rb->n_cursors; i++)
+		sertee_cursor_seek(&rb->cursors[i], rb->ring.head);
+	publish_chunk(rb);
+}
+
+// the number of unread bytes of one cursor, like poll() and FIONREAD do
+static void run_lag(struct ringbench *rb, uint64_t n) {
+	volatile size_t lag;
+	
+	while (n--) {
+		lag = sertee_cursor_lag(&rb->cursors[rb->next]);
+		rb->next = rb->next + 1 < rb->n_cursors ? rb->next + 1 : 0;
+	}
+	
+	(void) lag;
+}
+
+// one reader copies one chunk to its buffer, like a read() of a device.
+// After all readers did, the next chunk is published.
+static void run_read(struct ringbench *rb, uint64_t n) {
+	while (n--) {
+		read_chunk(rb, &rb->cursors[rb->next]);
+		rb->next += 1;
+		if (rb->next == rb->n_cursors) {
+			rb->next = 0;
+			publish_chunk(rb);
+		}
+	}
+}
+
+// the source publishes one chunk and no reader keeps up, so every commit
+// moves all cursors
+static void setup_overtake(struct ringbench *rb) {
+	while (rb->ring.head < 2 * rb->ring.size)
+		publish_chunk(rb);
+}
+
+static void run_publish(struct ringbench *rb, uint64_t n) {
+	while (n--)
+		publish_chunk(rb);
+}
+
+// the source publishes one chunk and every reader reads it
+static void run_fanout(struct ringbench *rb, uint64_t n) {
+	size_t i;
+	
+	while (n--) {
+		publish_chunk(rb);
+		for (i=0; i < rb->n_cursors; i++)
+			read_chunk(rb, &rb->cursors[i]);
+	}
+}
+
+static struct ringbench_op ops[] = {
+	{ "lag", "query the unread bytes of one reader", setup_filled, run_lag },
+	{ "read", "one reader reads a chunk", setup_filled, run_read },
+	{ "publish", "publish a chunk, all readers are overtaken", setup_overtake, run_publish },
+	{ "fanout", "publish a chunk and let all readers read it", setup_filled, run_fanout },
+};
+
+static int perf_open(void) {
+	struct perf_event_attr attr;
+	
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void show_help(FILE *fd) {
+	size_t i;
+	
+	fprintf(fd, "usage: libsertee-bench [options]\n");
+	fprintf(fd, "\n");
+	fprintf(fd, "options:\n");
+	fprintf(fd, "    --help|-h             print this help message\n");
+	fprintf(fd, "    --ops=LIST            operations to measure (default: lag,read,publish,fanout)\n");
+	fprintf(fd, "    --readers=LIST        numbers of readers (default: 1,10,100,1000,10000)\n");
+	fprintf(fd, "    --bufsize=LIST        ring sizes (default: 4096,65536,1048576)\n");
+	fprintf(fd, "    --chunk=LIST          bytes per publish and read (default: 1,64,4096)\n");
+	fprintf(fd, "    --time=MS             minimum duration of each measurement (default: 200)\n");
+	fprintf(fd, "\n");
+	fprintf(fd, "operations:\n");
+	for (i=0; i < sizeof(ops) / sizeof(ops[0]); i++)
+		fprintf(fd, "    %-22s%s\n", ops[i].name, ops[i].desc);
+}
+
+static int parse_list(const char *arg, size_t *list) {
+	char *end;
+	int n;
+	
+	for (n = 0; n < MAX_LIST; n++) {
+		list[n] = strtoull(arg, &end, 0);
+		if (end == arg || list[n] == 0)
+			return -1;
+		if (*end == 0)
+			return n + 1;
+		if (*end != ',')
+			return -1;
+		arg = end + 1;
+	}
+	
+	return -1;
+}
+
+static int measure(const struct ringbench_op *op, size_t n_cursors, size_t bufsize, size_t chunk,
+	uint64_t min_time, int perf_fd)
+{
+	struct ringbench rb;
+	uint64_t n, batch, start, elapsed, misses;
+	size_t i, j, tmp, *order;
+	char *buf;
+	
+	memset(&rb, 0, sizeof(rb));
+	buf = (char *) malloc(bufsize);
+	rb.cursors = (struct sertee_cursor *) calloc(n_cursors, sizeof(struct sertee_cursor));
+	order = (size_t *) malloc(n_cursors * sizeof(size_t));
+	rb.data = (char *) malloc(chunk);
+	rb.out = (char *) malloc(chunk);
+	if (!buf || !rb.cursors || !order || !rb.data || !rb.out) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+	rb.n_cursors = n_cursors;
+	rb.chunk = chunk;
+	memset(rb.data, 'x', chunk);
+	
+	sertee_ring_init(&rb.ring, buf, bufsize, 0);
+	
+	// like devices in sertee, the list of cursors is not ordered by address
+	for (i=0; i < n_cursors; i++)
+		order[i] = i;
+	srand(1);
+	for (i=n_cursors; i > 1; i--) {
+		j = rand() % i;
+		tmp = order[i - 1];
+		order[i - 1] = order[j];
+		order[j] = tmp;
+	}
+	for (i=0; i < n_cursors; i++)
+		sertee_cursor_open(&rb.ring, &rb.cursors[order[i]]);
+	
+	op->setup(&rb);
+	
+	// warm up, then double the batch until it runs long enough
+	op->run(&rb, 1);
+	for (batch = 1; ; batch *= 2) {
+		if (perf_fd >= 0) {
+			ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+		
+		start = bench_mono();
+		op->run(&rb, batch);
+		elapsed = bench_mono() - start;
+		
+		if (perf_fd >= 0)
+			ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+		
+		if (elapsed >= min_time)
+			break;
+	}
+	n = batch;
+	
+	printf("%-8s %8zu %10zu %8zu %12" PRIu64 " %12.1f", op->name, n_cursors, bufsize, chunk,
+		n, (double) elapsed / n);
+	if (perf_fd >= 0 && read(perf_fd, &misses, sizeof(misses)) == sizeof(misses))
+		printf(" %12.2f\n", (double) misses / n);
+	else
+		printf(" %12s\n", "-");
+	fflush(stdout);
+	
+	for (i=0; i < n_cursors; i++)
+		sertee_cursor_close(&rb.cursors[i]);
+	sertee_ring_destroy(&rb.ring);
+	free(rb.out);
+	free(rb.data);
+	free(order);
+	free(rb.cursors);
+	free(buf);
+	
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	static const struct option long_opts[] = {
+		{ "help", no_argument, 0, 'h' },
+		{ "ops", required_argument, 0, 'o' },
+		{ "readers", required_argument, 0, 'r' },
+		{ "bufsize", required_argument, 0, 'b' },
+		{ "chunk", required_argument, 0, 'c' },
+		{ "time", required_argument, 0, 't' },
+		{ 0, 0, 0, 0 },
+	};
+	size_t readers[MAX_LIST] = { 1, 10, 100, 1000, 10000 };
+	size_t bufsizes[MAX_LIST] = { 4096, 65536, 1048576 };
+	size_t chunks[MAX_LIST] = { 1, 64, 4096 };
+	int n_readers = 5, n_bufsizes = 3, n_chunks = 3;
+	const char *op_names = "lag,read,publish,fanout";
+	uint64_t min_time = 200;
+	char *names, *name, *saveptr;
+	int opt, i, j, k, perf_fd, found;
+	size_t o;
+	
+	while ((opt = getopt_long(argc, argv, "h", long_opts, 0)) != -1) {
+		switch (opt) {
+			case 'o': op_names = optarg; break;
+			case 'r': n_readers = parse_list(optarg, readers); break;
+			case 'b': n_bufsizes = parse_list(optarg, bufsizes); break;
+			case 'c': n_chunks = parse_list(optarg, chunks); break;
+			case 't': min_time = strtoull(optarg, 0, 0); break;
+			case 'h':
+				show_help(stdout);
+				return 0;
+			default:
+				show_help(stderr);
+				return 1;
+		}
+	}
+	
+	if (n_readers < 0 || n_bufsizes < 0 || n_chunks < 0) {
+		fprintf(stderr, "error, invalid list\n");
+		return 1;
+	}
+	min_time *= 1000000;
+	
+	perf_fd = perf_open();
+	if (perf_fd < 0)
+		fprintf(stderr, "perf_event_open() failed, no cache misses: %s\n", strerror(errno));
+	
+	printf("%-8s %8s %10s %8s %12s %12s %12s\n", "op", "readers", "bufsize", "chunk", "ops", "ns/op",
+		"misses/op");
+	
+	names = strdup(op_names);
+	for (name = strtok_r(names, ",", &saveptr); name; name = strtok_r(0, ",", &saveptr)) {
+		found = 0;
+		for (o=0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+			if (strcmp(ops[o].name, name))
+				continue;
+			
+			found = 1;
+			for (i=0; i < n_readers; i++)
+				for (j=0; j < n_bufsizes; j++)
+					for (k=0; k < n_chunks; k++)
+						if (measure(&ops[o], readers[i], bufsizes[j], chunks[k], min_time, perf_fd))
+							return 1;
+		}
+		
+		if (!found) {
+			fprintf(stderr, "error, unknown operation \"%s\"\n", name);
+			return 1;
+		}
+	}
+	free(names);
+	
+	return 0;
+}
@@ -0,0 +1,340 @@
+/*
+ * libsertee-test
+ * ----------
+ *
+ * tests of the ring and cursor logic of libsertee, run with `make test`
+ *
+ * License: MPL-2.0
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libsertee.h"
+
+static int failures;
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failures += 1; \
+		} \
+	} while (0)
+
+// read everything a new cursor at the oldest position returns
+static size_t read_oldest(struct sertee_ring *ring, char *out, size_t size) {
+	struct sertee_cursor cursor;
+	size_t len;
+	
+	sertee_cursor_open(ring, &cursor);
+	sertee_cursor_seek(&cursor, sertee_ring_oldest(ring));
+	len = sertee_cursor_read(&cursor, out, size);
+	sertee_cursor_close(&cursor);
+	
+	return len;
+}
+
+// publish into a ring that has not wrapped yet and read it in pieces
+static void test_publish_read(void) {
+	struct sertee_ring ring;
+	struct sertee_cursor a, b;
+	char out[64];
+	size_t len;
+	
+	sertee_ring_init(&ring, (char *) malloc(8), 8, 0);
+	sertee_cursor_open(&ring, &a);
+	sertee_ring_publish(&ring, "ABC", 3);
+	
+	// a new cursor starts at the head and does not see older data
+	sertee_cursor_open(&ring, &b);
+	CHECK(sertee_cursor_lag(&a) == 3 && sertee_cursor_lag(&b) == 0);
+	CHECK(sertee_ring_oldest(&ring) == 0);
+	
+	sertee_ring_publish(&ring, "DEF", 3);
+	len = sertee_cursor_read(&a, out, 2);
+	CHECK(len == 2 && !memcmp(out, "AB", 2));
+	len = sertee_cursor_read(&a, out, sizeof(out));
+	CHECK(len == 4 && !memcmp(out, "CDEF", 4));
+	len = sertee_cursor_read(&b, out, sizeof(out));
+	CHECK(len == 3 && !memcmp(out, "DEF", 3));
+	
+	// the data wraps at the end of the buffer
+	sertee_ring_publish(&ring, "GHIJK", 5);
+	len = sertee_cursor_read(&a, out, sizeof(out));
+	CHECK(len == 5 && !memcmp(out, "GHIJK", 5));
+	CHECK(sertee_cursor_lag(&a) == 0 && a.lost == 0 && b.lost == 0);
+	CHECK(sertee_cursor_read(&a, out, sizeof(out)) == 0);
+	
+	sertee_cursor_close(&b);
+	sertee_cursor_close(&a);
+	free(ring.buf);
+	sertee_ring_destroy(&ring);
+}
+
+static struct sertee_cursor *overrun_cursor;
+static uint64_t overrun_lost;
+static unsigned int overrun_calls;
+
+static void count_overrun(struct sertee_cursor *cursor, uint64_t lost) {
+	overrun_cursor = cursor;
+	overrun_lost += lost;
+	overrun_calls += 1;
+}
+
+// only the cursor that is overtaken is reported and moves to the oldest data
+static void test_overrun(void) {
+	struct sertee_ring ring;
+	struct sertee_cursor slow, fast;
+	char out[64];
+	size_t len;
+	
+	sertee_ring_init(&ring, (char *) malloc(8), 8, 0);
+	ring.overrun = count_overrun;
+	sertee_cursor_open(&ring, &slow);
+	sertee_cursor_open(&ring, &fast);
+	
+	sertee_ring_publish(&ring, "ABCDEF", 6);
+	sertee_cursor_read(&fast, out, sizeof(out));
+	CHECK(overrun_calls == 0);
+	
+	sertee_ring_publish(&ring, "GHIJ", 4);
+	CHECK(overrun_calls == 1 && overrun_cursor == &slow && overrun_lost == 2);
+	CHECK(slow.lost == 2 && slow.overruns == 1 && slow.offset == 2);
+	CHECK(fast.lost == 0 && fast.overruns == 0);
+	
+	len = sertee_cursor_read(&slow, out, sizeof(out));
+	CHECK(len == 8 && !memcmp(out, "CDEFGHIJ", 8));
+	
+	sertee_cursor_close(&fast);
+	sertee_cursor_close(&slow);
+	free(ring.buf);
+	sertee_ring_destroy(&ring);
+}
+
+// seek is limited to the buffered data
+static void test_seek(void) {
+	struct sertee_ring ring;
+	struct sertee_cursor cursor;
+	char out[64];
+	size_t len;
+	
+	sertee_ring_init(&ring, (char *) malloc(8), 8, 0);
+	sertee_cursor_open(&ring, &cursor);
+	sertee_ring_publish(&ring, "ABCDEFGHIJKL", 12);
+	
+	sertee_cursor_seek(&cursor, 0);
+	CHECK(cursor.offset == 4);
+	sertee_cursor_seek(&cursor, 100);
+	CHECK(cursor.offset == 12 && sertee_cursor_lag(&cursor) == 0);
+	
+	sertee_cursor_seek(&cursor, 9);
+	len = sertee_cursor_read(&cursor, out, sizeof(out));
+	CHECK(len == 3 && !memcmp(out, "JKL", 3));
+	
+	sertee_cursor_close(&cursor);
+	free(ring.buf);
+	sertee_ring_destroy(&ring);
+}
+
+// the zero-copy interface returns contiguous parts up to the end of the buffer
+static void test_reserve_commit(void) {
+	struct sertee_ring ring;
+	struct sertee_cursor cursor;
+	const char *src;
+	char *dst;
+	size_t n;
+	
+	sertee_ring_init(&ring, (char *) malloc(8), 8, 0);
+	sertee_cursor_open(&ring, &cursor);
+	
+	dst = sertee_ring_reserve(&ring, &n);
+	CHECK(dst == ring.buf && n == 8);
+	memcpy(dst, "ABCDEF", 6);
+	sertee_ring_commit(&ring, 6);
+	
+	dst = sertee_ring_reserve(&ring, &n);
+	CHECK(dst == ring.buf + 6 && n == 2);
+	
+	src = sertee_cursor_peek(&cursor, &n);
+	CHECK(n == 6 && !memcmp(src, "ABCDEF", 6));
+	sertee_cursor_consume(&cursor, 4);
+	
+	memcpy(dst, "GH", 2);
+	sertee_ring_commit(&ring, 2);
+	dst = sertee_ring_reserve(&ring, &n);
+	CHECK(dst == ring.buf && n == 8);
+	memcpy(dst, "IJ", 2);
+	sertee_ring_commit(&ring, 2);
+	
+	// the unread data wraps, peek only returns the part up to the end
+	src = sertee_cursor_peek(&cursor, &n);
+	CHECK(n == 4 && !memcmp(src, "EFGH", 4));
+	sertee_cursor_consume(&cursor, n);
+	src = sertee_cursor_peek(&cursor, &n);
+	CHECK(n == 2 && !memcmp(src, "IJ", 2));
+	sertee_cursor_consume(&cursor, n);
+	sertee_cursor_peek(&cursor, &n);
+	CHECK(n == 0 && cursor.lost == 0);
+	
+	sertee_cursor_close(&cursor);
+	free(ring.buf);
+	sertee_ring_destroy(&ring);
+}
+
+// waiting is only possible on a shared ring and returns once data is there
+static void test_wait(void) {
+	struct sertee_ring ring;
+	struct sertee_cursor cursor;
+	
+	sertee_ring_init(&ring, (char *) malloc(8), 8, 0);
+	sertee_cursor_open(&ring, &cursor);
+	CHECK(sertee_cursor_wait(&cursor, 1, 0) == EINVAL);
+	sertee_cursor_close(&cursor);
+	free(ring.buf);
+	sertee_ring_destroy(&ring);
+	
+	sertee_ring_init(&ring, (char *) malloc(8), 8, 1);
+	sertee_cursor_open(&ring, &cursor);
+	CHECK(sertee_cursor_wait(&cursor, 1, 10) == ETIMEDOUT);
+	sertee_ring_publish(&ring, "AB", 2);
+	CHECK(sertee_cursor_wait(&cursor, 2, 10) == 0);
+	CHECK(sertee_cursor_wait(&cursor, 3, 10) == ETIMEDOUT);
+	sertee_cursor_close(&cursor);
+	free(ring.buf);
+	sertee_ring_destroy(&ring);
+}
+
+// after growing a ring that wrapped, only the copied data is readable
+static void test_grow_wrapped(void) {
+	struct sertee_ring ring;
+	char *buf, *old, out[64];
+	size_t len;
+	
+	buf = (char *) malloc(4);
+	sertee_ring_init(&ring, buf, 4, 0);
+	sertee_ring_publish(&ring, "ABCDEFGHIJ", 10);
+	CHECK(sertee_ring_oldest(&ring) == 6);
+	
+	old = sertee_ring_resize(&ring, (char *) malloc(8), 8);
+	free(old);
+	
+	CHECK(sertee_ring_oldest(&ring) == 6);
+	len = read_oldest(&ring, out, sizeof(out));
+	CHECK(len == 4 && !memcmp(out, "GHIJ", 4));
+	
+	// the new space fills up until the full size is valid again
+	sertee_ring_publish(&ring, "KL", 2);
+	len = read_oldest(&ring, out, sizeof(out));
+	CHECK(len == 6 && !memcmp(out, "GHIJKL", 6));
+	
+	sertee_ring_publish(&ring, "MNOPQR", 6);
+	CHECK(sertee_ring_oldest(&ring) == 10);
+	len = read_oldest(&ring, out, sizeof(out));
+	CHECK(len == 8 && !memcmp(out, "KLMNOPQR", 8));
+	
+	free(ring.buf);
+	sertee_ring_destroy(&ring);
+}
+
+// a cursor behind the data that survives a shrink loses the oldest part
+static void test_shrink(void) {
+	struct sertee_ring ring;
+	struct sertee_cursor cursor;
+	char *old, out[64];
+	size_t len;
+	
+	sertee_ring_init(&ring, (char *) malloc(8), 8, 0);
+	sertee_cursor_open(&ring, &cursor);
+	sertee_ring_publish(&ring, "ABCDEFGHIJK", 11);
+	CHECK(cursor.lost == 3 && cursor.offset == 3);
+	
+	old = sertee_ring_resize(&ring, (char *) malloc(4), 4);
+	free(old);
+	
+	CHECK(cursor.lost == 7 && cursor.overruns == 2);
+	len = sertee_cursor_read(&cursor, out, sizeof(out));
+	CHECK(len == 4 && !memcmp(out, "HIJK", 4));
+	
+	sertee_cursor_close(&cursor);
+	free(ring.buf);
+	sertee_ring_destroy(&ring);
+}
+
+// growing twice before the ring filled up keeps only real data readable
+static void test_grow_twice(void) {
+	struct sertee_ring ring;
+	char *old, out[64];
+	size_t len;
+	
+	sertee_ring_init(&ring, (char *) malloc(4), 4, 1);
+	sertee_ring_publish(&ring, "ABCDEF", 6);
+	free(sertee_ring_resize(&ring, (char *) malloc(8), 8));
+	sertee_ring_publish(&ring, "G", 1);
+	old = sertee_ring_resize(&ring, (char *) malloc(16), 16);
+	free(old);
+	
+	len = read_oldest(&ring, out, sizeof(out));
+	CHECK(len == 5 && !memcmp(out, "CDEFG", 5));
+	
+	free(ring.buf);
+	sertee_ring_destroy(&ring);
+}
+
+// like a source that grows its ring after a reader was overtaken: the reader
+// and a reader that opens afterwards only get real data
+static void test_grow_overrun(void) {
+	struct sertee_ring ring;
+	struct sertee_cursor cursor;
+	char out[64];
+	size_t len;
+	
+	sertee_ring_init(&ring, (char *) malloc(4), 4, 0);
+	sertee_cursor_open(&ring, &cursor);
+	sertee_ring_publish(&ring, "ABCDEFGHIJ", 10);
+	CHECK(cursor.lost == 6 && cursor.offset == 6);
+	
+	free(sertee_ring_resize(&ring, (char *) malloc(8), 8));
+	CHECK(cursor.lost == 6 && cursor.offset == 6);
+	
+	len = read_oldest(&ring, out, sizeof(out));
+	CHECK(len == 4 && !memcmp(out, "GHIJ", 4));
+	
+	sertee_ring_publish(&ring, "KLM", 3);
+	len = sertee_cursor_read(&cursor, out, sizeof(out));
+	CHECK(len == 7 && !memcmp(out, "GHIJKLM", 7));
+	
+	// shrinking below the valid data drops it from the start as before
+	free(sertee_ring_resize(&ring, (char *) malloc(2), 2));
+	CHECK(sertee_ring_oldest(&ring) == 11);
+	len = read_oldest(&ring, out, sizeof(out));
+	CHECK(len == 2 && !memcmp(out, "LM", 2));
+	
+	sertee_cursor_close(&cursor);
+	free(ring.buf);
+	sertee_ring_destroy(&ring);
+}
+
+int main(int argc, char **argv) {
+	test_publish_read();
+	test_overrun();
+	test_seek();
+	test_reserve_commit();
+	test_wait();
+	test_grow_wrapped();
+	test_shrink();
+	test_grow_twice();
+	test_grow_overrun();
+	
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	
+	printf("all tests passed\n");
+	
+	return 0;
+}
@@ -0,0 +1,299 @@
+/*
+ * libsertee
+ * ----------
+ *
+ * the ring buffer and fan-out core of sertee, see libsertee.h
+ *
+ * License: MPL-2.0
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "libsertee.h"
+
+int sertee_ring_init(struct sertee_ring *ring, char *buf, size_t size, int shared) {
+	pthread_condattr_t attr;
+	int rv;
+	
+	memset(ring, 0, sizeof(struct sertee_ring));
+	ring->buf = buf;
+	ring->size = size;
+	ring->shared = shared;
+	
+	if (!shared)
+		return 0;
+	
+	rv = pthread_mutex_init(&ring->lock, 0);
+	if (rv)
+		return rv;
+	
+	// timeouts of sertee_cursor_wait() must not jump with the wall clock
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	rv = pthread_cond_init(&ring->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (rv)
+		pthread_mutex_destroy(&ring->lock);
+	
+	return rv;
+}
+
+void sertee_ring_destroy(struct sertee_ring *ring) {
+	if (!ring->shared)
+		return;
+	
+	pthread_cond_destroy(&ring->cond);
+	pthread_mutex_destroy(&ring->lock);
+}
+
+static void ring_lock(struct sertee_ring *ring) {
+	if (ring->shared)
+		pthread_mutex_lock(&ring->lock);
+}
+
+static void ring_unlock(struct sertee_ring *ring) {
+	if (ring->shared)
+		pthread_mutex_unlock(&ring->lock);
+}
+
+static uint64_t ring_oldest(struct sertee_ring *ring) {
+	if (ring->head > ring->size && ring->head - ring->size > ring->tail)
+		return ring->head - ring->size;
+	
+	return ring->tail;
+}
+
+uint64_t sertee_ring_oldest(struct sertee_ring *ring) {
+	uint64_t oldest;
+	
+	ring_lock(ring);
+	oldest = ring_oldest(ring);
+	ring_unlock(ring);
+	
+	return oldest;
+}
+
+// move every cursor behind the oldest buffered byte to it
+static void ring_drop_old(struct sertee_ring *ring) {
+	struct sertee_cursor *cursor;
+	uint64_t oldest, lost;
+	
+	oldest = ring_oldest(ring);
+	for (cursor = ring->cursors; cursor; cursor = cursor->next) {
+		if (cursor->offset >= oldest)
+			continue;
+		
+		lost = oldest - cursor->offset;
+		cursor->offset = oldest;
+		__atomic_store_n(&cursor->lost, cursor->lost + lost, __ATOMIC_RELAXED);
+		__atomic_store_n(&cursor->overruns, cursor->overruns + 1, __ATOMIC_RELAXED);
+		
+		if (ring->overrun)
+			ring->overrun(cursor, lost);
+	}
+}
+
+char *sertee_ring_reserve(struct sertee_ring *ring, size_t *len) {
+	*len = ring->size - ring->head % ring->size;
+	
+	return ring->buf + ring->head % ring->size;
+}
+
+void sertee_ring_commit(struct sertee_ring *ring, size_t len) {
+	ring->head += len;
+	
+	ring_drop_old(ring);
+}
+
+void sertee_ring_publish(struct sertee_ring *ring, const void *data, size_t len) {
+	const char *src = (const char *) data;
+	size_t n;
+	char *dst;
+	
+	ring_lock(ring);
+	
+	// only the newest size bytes survive anyway
+	if (len > ring->size) {
+		ring->head += len - ring->size;
+		src += len - ring->size;
+		len = ring->size;
+	}
+	
+	while (len) {
+		dst = sertee_ring_reserve(ring, &n);
+		if (n > len)
+			n = len;
+		memcpy(dst, src, n);
+		sertee_ring_commit(ring, n);
+		
+		src += n;
+		len -= n;
+	}
+	
+	if (ring->shared) {
+		pthread_cond_broadcast(&ring->cond);
+		pthread_mutex_unlock(&ring->lock);
+	}
+}
+
+char *sertee_ring_resize(struct sertee_ring *ring, char *buf, size_t size) {
+	char *old_buf;
+	size_t old_size, len, n;
+	uint64_t off;
+	
+	ring_lock(ring);
+	
+	old_buf = ring->buf;
+	old_size = ring->size;
+	
+	// copy the newest data, the oldest part may wrap in both buffers
+	len = ring->head - ring_oldest(ring);
+	if (len > size)
+		len = size;
+	for (off = ring->head - len; off < ring->head; off += n) {
+		n = ring->head - off;
+		if (n > old_size - off % old_size)
+			n = old_size - off % old_size;
+		if (n > size - off % size)
+			n = size - off % size;
+		memcpy(buf + off % size, old_buf + off % old_size, n);
+	}
+	
+	ring->buf = buf;
+	ring->tail = ring->head - len;
+	// the size may be read by other threads for statistics
+	__atomic_store_n(&ring->size, size, __ATOMIC_RELAXED);
+	
+	ring_drop_old(ring);
+	
+	ring_unlock(ring);
+	
+	return old_buf;
+}
+
+void sertee_cursor_open(struct sertee_ring *ring, struct sertee_cursor *cursor) {
+	memset(cursor, 0, sizeof(struct sertee_cursor));
+	cursor->ring = ring;
+	
+	ring_lock(ring);
+	cursor->offset = ring->head;
+	
+	cursor->next = ring->cursors;
+	if (cursor->next)
+		cursor->next->prev = cursor;
+	ring->cursors = cursor;
+	ring_unlock(ring);
+}
+
+void sertee_cursor_close(struct sertee_cursor *cursor) {
+	struct sertee_ring *ring = cursor->ring;
+	
+	ring_lock(ring);
+	if (cursor->prev)
+		cursor->prev->next = cursor->next;
+	else
+		ring->cursors = cursor->next;
+	if (cursor->next)
+		cursor->next->prev = cursor->prev;
+	ring_unlock(ring);
+	
+	cursor->prev = 0;
+	cursor->next = 0;
+}
+
+size_t sertee_cursor_lag(struct sertee_cursor *cursor) {
+	size_t lag;
+	
+	ring_lock(cursor->ring);
+	lag = cursor->ring->head - cursor->offset;
+	ring_unlock(cursor->ring);
+	
+	return lag;
+}
+
+void sertee_cursor_seek(struct sertee_cursor *cursor, uint64_t offset) {
+	struct sertee_ring *ring = cursor->ring;
+	
+	ring_lock(ring);
+	if (offset > ring->head)
+		offset = ring->head;
+	if (offset < ring_oldest(ring))
+		offset = ring_oldest(ring);
+	cursor->offset = offset;
+	ring_unlock(ring);
+}
+
+const char *sertee_cursor_peek(struct sertee_cursor *cursor, size_t *len) {
+	struct sertee_ring *ring = cursor->ring;
+	size_t pos;
+	
+	pos = cursor->offset % ring->size;
+	*len = ring->head - cursor->offset;
+	if (*len > ring->size - pos)
+		*len = ring->size - pos;
+	
+	return ring->buf + pos;
+}
+
+void sertee_cursor_consume(struct sertee_cursor *cursor, size_t len) {
+	cursor->offset += len;
+}
+
+size_t sertee_cursor_read(struct sertee_cursor *cursor, void *buf, size_t size) {
+	const char *data;
+	size_t done, n;
+	
+	ring_lock(cursor->ring);
+	for (done = 0; done < size; done += n) {
+		data = sertee_cursor_peek(cursor, &n);
+		if (n == 0)
+			break;
+		if (n > size - done)
+			n = size - done;
+		
+		memcpy((char *) buf + done, data, n);
+		sertee_cursor_consume(cursor, n);
+	}
+	ring_unlock(cursor->ring);
+	
+	return done;
+}
+
+int sertee_cursor_wait(struct sertee_cursor *cursor, size_t lowat, int timeout_ms) {
+	struct sertee_ring *ring = cursor->ring;
+	struct timespec deadline;
+	int rv;
+	
+	if (!ring->shared)
+		return EINVAL;
+	
+	// the lag never exceeds the size of the ring
+	if (lowat == 0)
+		lowat = 1;
+	if (lowat > ring->size)
+		lowat = ring->size;
+	
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	
+	rv = 0;
+	pthread_mutex_lock(&ring->lock);
+	while (ring->head - cursor->offset < lowat && rv == 0) {
+		if (timeout_ms < 0)
+			rv = pthread_cond_wait(&ring->cond, &ring->lock);
+		else
+			rv = pthread_cond_timedwait(&ring->cond, &ring->lock, &deadline);
+	}
+	pthread_mutex_unlock(&ring->lock);
+	
+	return rv;
+}
@@ -0,0 +1,105 @@
+/*
+ * libsertee
+ * ----------
+ *
+ * the ring buffer and fan-out core of sertee: a producer publishes a byte
+ * stream into a ring with a bounded history and every consumer reads its own
+ * complete copy through a cursor
+ *
+ * License: MPL-2.0
+ */
+
+#ifndef LIBSERTEE_H
+#define LIBSERTEE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+struct sertee_ring;
+
+// read position of a consumer. Offsets are absolute positions in the stream
+// like in struct sertee_offsets.
+struct sertee_cursor {
+	struct sertee_ring *ring;
+	struct sertee_cursor *prev;
+	struct sertee_cursor *next;
+	
+	// position of the next byte this cursor returns
+	uint64_t offset;
+	
+	// bytes that were overwritten before they were read and the number of
+	// times this happened, written with relaxed atomics
+	uint64_t lost;
+	uint64_t overruns;
+};
+
+struct sertee_ring {
+	char *buf;
+	size_t size;
+	
+	// position of the next byte that will be published
+	uint64_t head;
+	
+	// oldest position with valid data. It only exceeds head - size after
+	// the ring grew, as the new part of the buffer was never written.
+	uint64_t tail;
+	
+	// open cursors
+	struct sertee_cursor *cursors;
+	
+	// called for every cursor the producer overtook, may be 0
+	void (*overrun)(struct sertee_cursor *cursor, uint64_t lost);
+	
+	// a shared ring may be used by different threads and every call locks
+	// it. Otherwise, the caller guarantees that only one thread uses the
+	// ring and its cursors.
+	int shared;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+// buf with size bytes is owned by the caller
+int sertee_ring_init(struct sertee_ring *ring, char *buf, size_t size, int shared);
+void sertee_ring_destroy(struct sertee_ring *ring);
+
+// oldest position that is still buffered
+uint64_t sertee_ring_oldest(struct sertee_ring *ring);
+
+// copy len bytes into the ring and wake up waiting consumers
+void sertee_ring_publish(struct sertee_ring *ring, const void *data, size_t len);
+
+// zero-copy variant for rings that are not shared: reserve returns the
+// contiguous space for the next bytes and stores its size in len, commit
+// publishes the first len bytes of it
+char *sertee_ring_reserve(struct sertee_ring *ring, size_t *len);
+void sertee_ring_commit(struct sertee_ring *ring, size_t len);
+
+// move the buffered data into buf with size bytes and return the old buffer.
+// Cursors whose data does not fit lose the oldest part.
+char *sertee_ring_resize(struct sertee_ring *ring, char *buf, size_t size);
+
+// a new cursor starts at the head of the ring
+void sertee_cursor_open(struct sertee_ring *ring, struct sertee_cursor *cursor);
+void sertee_cursor_close(struct sertee_cursor *cursor);
+
+// number of unread bytes
+size_t sertee_cursor_lag(struct sertee_cursor *cursor);
+
+// continue at offset, limited to the buffered data
+void sertee_cursor_seek(struct sertee_cursor *cursor, uint64_t offset);
+
+// copy up to size unread bytes into buf, returns the number of bytes
+size_t sertee_cursor_read(struct sertee_cursor *cursor, void *buf, size_t size);
+
+// zero-copy variant for rings that are not shared: peek returns the unread
+// bytes up to the end of the buffer and stores their number in len, consume
+// marks len bytes as read
+const char *sertee_cursor_peek(struct sertee_cursor *cursor, size_t *len);
+void sertee_cursor_consume(struct sertee_cursor *cursor, size_t len);
+
+// wait up to timeout_ms milliseconds (-1: forever) until at least lowat bytes
+// are unread. Returns 0, ETIMEDOUT or EINVAL if the ring is not shared.
+int sertee_cursor_wait(struct sertee_cursor *cursor, size_t lowat, int timeout_ms);
+
+#endif
@@ -0,0 +1,1070 @@
+/*
+ * sertee-bench
+ * ----------
+ *
+ * end-to-end benchmark of sertee: feeds a pseudo terminal with a configurable
+ * byte rate and chunk pattern, reads the copies from N devices and reports
+ * the throughput, the delivery latency, the CPU time per byte and lost data.
+ *
+ * Every copy is verified: the stream consists of numbered frames with a
+ * checksum, so the frames a reader missed, received twice or out of order
+ * are known exactly. With --ramp, the rate is increased step by step until
+ * the first loss occurs.
+ *
+ * With --replay, the source data of a pcapng file written by sertee
+ * --capture is written to the pty with its original chunks and timing
+ * instead.
+ *
+ * License: MPL-2.0
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <termios.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#include "sertee.h"
+
+#define BENCH_MAGIC 0x42545253
+#define BENCH_MAX_SAMPLES (1 << 20)
+#define BENCH_MAX_GAPS (1 << 16)
+#define BENCH_READ_SIZE 65536
+
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_EPB_OUTBOUND 2
+#define PCAPNG_ALIGN(x) (((x) + 3) & ~((size_t) 3))
+
+extern char **environ;
+
+// the stream consists of these frames, a reader finds them again after an
+// overrun by their magic and checksum. Frame seq occupies the stream bytes
+// from seq * sizeof(struct bench_rec) on.
+struct bench_rec {
+	uint32_t magic;
+	uint32_t seq;
+	uint64_t ts;
+	uint64_t sum;
+};
+
+// frames [start, end) a reader did not receive
+struct bench_gap {
+	uint64_t start;
+	uint64_t end;
+};
+
+// a chunk the source read, from a capture
+struct bench_pkt {
+	uint64_t ts;
+	const char *data;
+	uint32_t len;
+};
+
+struct bench_counts {
+	uint64_t bytes;
+	uint64_t frames;
+	uint64_t missed;
+	uint64_t duplicates;
+	uint64_t reordered;
+	// bytes that did not belong to a complete, valid frame
+	uint64_t corrupt;
+};
+
+struct bench_reader {
+	struct bench *bench;
+	unsigned int id;
+	char *path;
+	int fd;
+	pthread_t thread;
+	
+	struct bench_counts counts;
+	// counts at the start of the current step
+	struct bench_counts step;
+	uint64_t next_seq;
+	
+	// a frame that was split between two reads
+	char rec[sizeof(struct bench_rec)];
+	size_t rec_len;
+	
+	struct bench_gap *gaps;
+	size_t n_gaps;
+	char gaps_truncated;
+	
+	// delivery latencies, reservoir sampled once there are too many
+	uint64_t *samples;
+	uint64_t n_samples;
+	uint64_t rng;
+	
+	struct sertee_lag lag;
+};
+
+struct bench_step {
+	uint64_t rate;
+	uint64_t sent;
+	uint64_t chunks;
+	uint64_t elapsed;
+	double cpu;
+	int loss;
+	
+	// per reader
+	struct bench_counts *counts;
+};
+
+struct bench {
+	char *sertee;
+	unsigned int n_readers;
+	uint64_t rate;
+	uint64_t ramp;
+	unsigned int n_steps;
+	size_t chunk_min;
+	size_t chunk_max;
+	unsigned int burst;
+	unsigned int duration;
+	unsigned int drain;
+	int json;
+	char *replay;
+	char *replay_source;
+	double speed;
+	char **extra;
+	int n_extra;
+	
+	int master_fd;
+	int slave_fd;
+	char slave_name[64];
+	pid_t pid;
+	
+	struct bench_reader *readers;
+	volatile int stop;
+	
+	// state of the writer that continues over all steps
+	struct bench_rec rec;
+	size_t rec_pos;
+	uint32_t seq;
+	uint64_t rng;
+	
+	// capture for --replay
+	char *replay_buf;
+	struct bench_pkt *pkts;
+	size_t n_pkts;
+	
+	struct bench_step *steps;
+	unsigned int steps_done;
+	uint64_t sent;
+	uint64_t elapsed;
+	double cpu;
+};
+
+static uint64_t bench_mono(void) {
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t bench_rand(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	
+	return *state;
+}
+
+// splitmix64 of the other fields
+static uint64_t bench_sum(const struct bench_rec *rec) {
+	uint64_t x;
+	
+	x = ((uint64_t) rec->magic << 32 | rec->seq) ^ rec->ts;
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	
+	return x ^ (x >> 31);
+}
+
+// number of frames that were written completely
+static uint64_t bench_frames(struct bench *bench) {
+	return bench->rec_pos ? bench->seq - 1 : bench->seq;
+}
+
+static void show_help(FILE *fd) {
+	fprintf(fd, "usage: sertee-bench [options] [-- sertee options]\n");
+	fprintf(fd, "\n");
+	fprintf(fd, "options:\n");
+	fprintf(fd, "    --help|-h             print this help message\n");
+	fprintf(fd, "    --sertee=PATH         sertee binary (default: ./sertee)\n");
+	fprintf(fd, "    --readers=N           number of devices and readers (default: 4)\n");
+	fprintf(fd, "    --rate=BPS            bytes per second written to the source, 0 writes as\n");
+	fprintf(fd, "                          fast as possible (default: 11520)\n");
+	fprintf(fd, "    --chunk=SIZE|MIN-MAX  bytes per write, random between MIN and MAX (default: 64)\n");
+	fprintf(fd, "    --burst=N             write N chunks at once between pauses (default: 1)\n");
+	fprintf(fd, "    --duration=SECONDS    time to write data, per step with --ramp (default: 10)\n");
+	fprintf(fd, "    --drain=MS            time for the readers to catch up (default: 1000)\n");
+	fprintf(fd, "    --ramp=BPS            increase the rate by BPS after every step until data is\n");
+	fprintf(fd, "                          lost\n");
+	fprintf(fd, "    --steps=N             maximum number of steps with --ramp (default: 10)\n");
+	fprintf(fd, "    --json                print the results as JSON\n");
+	fprintf(fd, "    --replay=FILE         write the source data of a pcapng file from sertee\n");
+	fprintf(fd, "                          --capture instead of generated frames\n");
+	fprintf(fd, "    --replay-source=NAME  source in the capture to replay (default: the first)\n");
+	fprintf(fd, "    --speed=FACTOR        replay speed, 0 replays as fast as possible (default: 1)\n");
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+	ssize_t rv;
+	size_t pos;
+	
+	for (pos = 0; pos < len; pos += rv) {
+		rv = write(fd, data + pos, len - pos);
+		if (rv < 0) {
+			if (errno == EINTR) {
+				rv = 0;
+				continue;
+			}
+			
+			fprintf(stderr, "write() to the pty failed: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+static int bench_write(struct bench *bench, struct bench_step *step) {
+	struct timespec ts;
+	char *buf;
+	size_t len, pos, n;
+	uint64_t start, end, due;
+	
+	buf = (char *) malloc(bench->chunk_max);
+	if (!buf)
+		return -1;
+	
+	start = bench_mono();
+	end = start + bench->duration * 1000000000ULL;
+	
+	while (bench_mono() < end) {
+		// a burst starts once the bytes written so far are due
+		if (step->rate && step->chunks % bench->burst == 0) {
+			due = start + step->sent * 1000000000ULL / step->rate;
+			ts.tv_sec = due / 1000000000;
+			ts.tv_nsec = due % 1000000000;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0);
+		}
+		
+		len = bench->chunk_min;
+		if (bench->chunk_max > bench->chunk_min)
+			len += bench_rand(&bench->rng) % (bench->chunk_max - bench->chunk_min + 1);
+		
+		for (pos = 0; pos < len; pos += n) {
+			if (bench->rec_pos == 0) {
+				bench->rec.magic = BENCH_MAGIC;
+				bench->rec.seq = bench->seq++;
+				bench->rec.ts = bench_mono();
+				bench->rec.sum = bench_sum(&bench->rec);
+			}
+			
+			n = sizeof(bench->rec) - bench->rec_pos;
+			if (n > len - pos)
+				n = len - pos;
+			memcpy(buf + pos, (char *) &bench->rec + bench->rec_pos, n);
+			bench->rec_pos = (bench->rec_pos + n) % sizeof(bench->rec);
+		}
+		
+		if (write_all(bench->master_fd, buf, len)) {
+			free(buf);
+			return -1;
+		}
+		
+		step->sent += len;
+		step->chunks += 1;
+	}
+	
+	step->elapsed = bench_mono() - start;
+	free(buf);
+	
+	return 0;
+}
+
+// read the inbound packets of one interface of a pcapng file
+static int bench_load_capture(struct bench *bench) {
+	uint32_t type, len, iface, caplen, u32;
+	uint64_t tsmul[256], tsdiv[256];
+	uint16_t code, olen;
+	size_t size, pos, opt, end, alloc;
+	int n_ifaces, selected, outbound, i;
+	uint8_t tsresol;
+	char name[256];
+	FILE *f;
+	
+	f = fopen(bench->replay, "r");
+	if (!f) {
+		fprintf(stderr, "opening \"%s\" failed: %s\n", bench->replay, strerror(errno));
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	bench->replay_buf = (char *) malloc(size);
+	if (!bench->replay_buf || fread(bench->replay_buf, 1, size, f) != size) {
+		fprintf(stderr, "reading \"%s\" failed\n", bench->replay);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	
+	n_ifaces = 0;
+	selected = -1;
+	alloc = 0;
+	for (pos = 0; pos + 12 <= size; pos += len) {
+		memcpy(&type, bench->replay_buf + pos, 4);
+		memcpy(&len, bench->replay_buf + pos + 4, 4);
+		if (len < 12 || len > size - pos) {
+			fprintf(stderr, "invalid block at offset %zu of \"%s\"\n", pos, bench->replay);
+			return -1;
+		}
+		end = pos + len - 4;
+		
+		if (type == PCAPNG_SHB) {
+			memcpy(&u32, bench->replay_buf + pos + 8, 4);
+			if (u32 != 0x1A2B3C4D) {
+				fprintf(stderr, "\"%s\" was written with a different byte order\n", bench->replay);
+				return -1;
+			}
+			
+			// interface numbers start over in every section
+			n_ifaces = 0;
+			selected = -1;
+		} else
+		if (type == PCAPNG_IDB && n_ifaces < 256) {
+			name[0] = 0;
+			tsresol = 6;
+			for (opt = pos + 16; opt + 4 <= end; opt += 4 + PCAPNG_ALIGN(olen)) {
+				memcpy(&code, bench->replay_buf + opt, 2);
+				memcpy(&olen, bench->replay_buf + opt + 2, 2);
+				if (code == PCAPNG_OPT_END || opt + 4 + olen > end)
+					break;
+				if (code == PCAPNG_OPT_IF_NAME && olen < sizeof(name)) {
+					memcpy(name, bench->replay_buf + opt + 4, olen);
+					name[olen] = 0;
+				}
+				if (code == PCAPNG_OPT_IF_TSRESOL && olen == 1)
+					tsresol = bench->replay_buf[opt + 4];
+			}
+			
+			if (tsresol & 0x80) {
+				fprintf(stderr, "binary timestamp resolutions are not supported\n");
+				return -1;
+			}
+			tsmul[n_ifaces] = 1;
+			tsdiv[n_ifaces] = 1;
+			for (i = tsresol; i < 9; i++)
+				tsmul[n_ifaces] *= 10;
+			for (i = 9; i < tsresol; i++)
+				tsdiv[n_ifaces] *= 10;
+			
+			if (selected < 0 && (!bench->replay_source || !strcmp(name, bench->replay_source)))
+				selected = n_ifaces;
+			n_ifaces += 1;
+		} else
+		if (type == PCAPNG_EPB && len >= 32) {
+			memcpy(&iface, bench->replay_buf + pos + 8, 4);
+			memcpy(&caplen, bench->replay_buf + pos + 20, 4);
+			if ((int) iface != selected || pos + 28 + PCAPNG_ALIGN(caplen) > end)
+				continue;
+			
+			// data written by clients is not part of the source stream
+			outbound = 0;
+			for (opt = pos + 28 + PCAPNG_ALIGN(caplen); opt + 4 <= end; opt += 4 + PCAPNG_ALIGN(olen)) {
+				memcpy(&code, bench->replay_buf + opt, 2);
+				memcpy(&olen, bench->replay_buf + opt + 2, 2);
+				if (code == PCAPNG_OPT_END || opt + 4 + olen > end)
+					break;
+				if (code == PCAPNG_OPT_EPB_FLAGS && olen == 4) {
+					memcpy(&u32, bench->replay_buf + opt + 4, 4);
+					outbound = (u32 & 3) == PCAPNG_EPB_OUTBOUND;
+				}
+			}
+			if (outbound || caplen == 0)
+				continue;
+			
+			if (bench->n_pkts == alloc) {
+				alloc = alloc ? alloc * 2 : 1024;
+				bench->pkts = (struct bench_pkt *) realloc(bench->pkts, alloc * sizeof(struct bench_pkt));
+				if (!bench->pkts)
+					return -1;
+			}
+			
+			memcpy(&u32, bench->replay_buf + pos + 12, 4);
+			bench->pkts[bench->n_pkts].ts = (uint64_t) u32 << 32;
+			memcpy(&u32, bench->replay_buf + pos + 16, 4);
+			bench->pkts[bench->n_pkts].ts |= u32;
+			bench->pkts[bench->n_pkts].ts = bench->pkts[bench->n_pkts].ts * tsmul[iface] / tsdiv[iface];
+			bench->pkts[bench->n_pkts].data = bench->replay_buf + pos + 28;
+			bench->pkts[bench->n_pkts].len = caplen;
+			bench->n_pkts += 1;
+		}
+	}
+	
+	if (bench->n_pkts == 0) {
+		fprintf(stderr, "no source data %s%s in \"%s\"\n", bench->replay_source ? "of " : "",
+			bench->replay_source ? bench->replay_source : "", bench->replay);
+		return -1;
+	}
+	
+	return 0;
+}
+
+// write the captured chunks with their original gaps divided by the speed
+static int bench_replay(struct bench *bench, struct bench_step *step) {
+	struct bench_pkt *pkt;
+	struct timespec ts;
+	uint64_t start, due;
+	size_t i;
+	
+	start = bench_mono();
+	
+	for (i=0; i < bench->n_pkts; i++) {
+		pkt = &bench->pkts[i];
+		
+		if (bench->speed > 0) {
+			due = start + (uint64_t) ((pkt->ts - bench->pkts[0].ts) / bench->speed);
+			ts.tv_sec = due / 1000000000;
+			ts.tv_nsec = due % 1000000000;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0);
+		}
+		
+		if (write_all(bench->master_fd, pkt->data, pkt->len))
+			return -1;
+		
+		step->sent += pkt->len;
+		step->chunks += 1;
+	}
+	
+	step->elapsed = bench_mono() - start;
+	
+	return 0;
+}
+
+static void reader_sample(struct bench_reader *reader, uint64_t latency) {
+	uint64_t i;
+	
+	reader->n_samples += 1;
+	if (reader->n_samples <= BENCH_MAX_SAMPLES) {
+		reader->samples[reader->n_samples - 1] = latency;
+		return;
+	}
+	
+	i = bench_rand(&reader->rng) % reader->n_samples;
+	if (i < BENCH_MAX_SAMPLES)
+		reader->samples[i] = latency;
+}
+
+static void reader_add_gap(struct bench_reader *reader, uint64_t start, uint64_t end) {
+	reader->counts.missed += end - start;
+	
+	if (reader->n_gaps == BENCH_MAX_GAPS) {
+		reader->gaps_truncated = 1;
+		return;
+	}
+	
+	reader->gaps[reader->n_gaps].start = start;
+	reader->gaps[reader->n_gaps].end = end;
+	reader->n_gaps += 1;
+}
+
+// a frame older than the newest one either fills a gap or is a duplicate
+static void reader_old_frame(struct bench_reader *reader, uint64_t seq) {
+	struct bench_gap *gap;
+	size_t i;
+	
+	// late frames usually belong to one of the newest gaps
+	for (i = reader->n_gaps; i > 0; i--) {
+		gap = &reader->gaps[i - 1];
+		if (seq < gap->start || seq >= gap->end)
+			continue;
+		
+		reader->counts.reordered += 1;
+		reader->counts.missed -= 1;
+		
+		if (gap->end - gap->start == 1) {
+			memmove(gap, gap + 1, (reader->n_gaps - i) * sizeof(struct bench_gap));
+			reader->n_gaps -= 1;
+		} else if (seq == gap->start) {
+			gap->start += 1;
+		} else if (seq == gap->end - 1) {
+			gap->end -= 1;
+		} else if (reader->n_gaps < BENCH_MAX_GAPS) {
+			memmove(gap + 1, gap, (reader->n_gaps - i + 1) * sizeof(struct bench_gap));
+			reader->n_gaps += 1;
+			gap[0].end = seq;
+			gap[1].start = seq + 1;
+		} else {
+			reader->gaps_truncated = 1;
+		}
+		
+		return;
+	}
+	
+	reader->counts.duplicates += 1;
+}
+
+// split the received data into frames, after an overrun we search the next
+// frame by its magic and checksum
+static void reader_parse(struct bench_reader *reader, const char *data, size_t len, uint64_t now) {
+	struct bench_rec rec;
+	size_t n;
+	
+	while (len) {
+		n = sizeof(rec) - reader->rec_len;
+		if (n > len)
+			n = len;
+		memcpy(reader->rec + reader->rec_len, data, n);
+		reader->rec_len += n;
+		data += n;
+		len -= n;
+		
+		if (reader->rec_len < sizeof(rec))
+			break;
+		
+		memcpy(&rec, reader->rec, sizeof(rec));
+		if (rec.magic != BENCH_MAGIC || rec.sum != bench_sum(&rec)) {
+			memmove(reader->rec, reader->rec + 1, sizeof(rec) - 1);
+			reader->rec_len = sizeof(rec) - 1;
+			reader->counts.corrupt += 1;
+			continue;
+		}
+		reader->rec_len = 0;
+		reader->counts.frames += 1;
+		
+		if (rec.seq < reader->next_seq) {
+			reader_old_frame(reader, rec.seq);
+			continue;
+		}
+		
+		if (rec.seq > reader->next_seq)
+			reader_add_gap(reader, reader->next_seq, rec.seq);
+		reader->next_seq = rec.seq + 1;
+		
+		reader_sample(reader, now > rec.ts ? now - rec.ts : 0);
+	}
+}
+
+static void *reader_thread(void *arg) {
+	struct bench_reader *reader = (struct bench_reader *) arg;
+	struct pollfd pfd;
+	char *buf;
+	ssize_t rv;
+	
+	buf = (char *) malloc(BENCH_READ_SIZE);
+	if (!buf)
+		return 0;
+	
+	pfd.fd = reader->fd;
+	pfd.events = POLLIN;
+	while (!reader->bench->stop) {
+		// wake up regularly to notice the end of the benchmark
+		rv = poll(&pfd, 1, 100);
+		if (rv <= 0)
+			continue;
+		
+		rv = read(reader->fd, buf, BENCH_READ_SIZE);
+		if (rv < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			
+			fprintf(stderr, "read() from %s failed: %s\n", reader->path, strerror(errno));
+			break;
+		}
+		
+		reader->counts.bytes += rv;
+		// replayed data does not consist of frames
+		if (!reader->bench->replay)
+			reader_parse(reader, buf, rv, bench_mono());
+	}
+	
+	free(buf);
+	
+	return 0;
+}
+
+// the source is the slave side of a pty in raw mode, we write to the master
+static int bench_pty(struct bench *bench) {
+	struct termios t;
+	
+	bench->master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (bench->master_fd == -1 || grantpt(bench->master_fd) || unlockpt(bench->master_fd) ||
+		ptsname_r(bench->master_fd, bench->slave_name, sizeof(bench->slave_name)))
+	{
+		fprintf(stderr, "creating pty failed: %s\n", strerror(errno));
+		return -1;
+	}
+	
+	// keeping the slave open avoids a hangup if sertee reopens it
+	bench->slave_fd = open(bench->slave_name, O_RDWR | O_NOCTTY);
+	if (bench->slave_fd == -1) {
+		fprintf(stderr, "opening %s failed: %s\n", bench->slave_name, strerror(errno));
+		return -1;
+	}
+	
+	tcgetattr(bench->slave_fd, &t);
+	cfmakeraw(&t);
+	tcsetattr(bench->slave_fd, TCSANOW, &t);
+	
+	return 0;
+}
+
+static int bench_start_sertee(struct bench *bench) {
+	char *argv[7 + bench->n_extra];
+	char source[128], *names;
+	size_t len;
+	uint64_t deadline;
+	unsigned int i;
+	int rv, argc, status;
+	
+	names = (char *) malloc(8 + bench->n_readers * 64);
+	if (!names)
+		return -1;
+	len = sprintf(names, "--name=");
+	for (i=0; i < bench->n_readers; i++)
+		len += sprintf(names + len, "%ssertee-bench-%d-%u", i ? "," : "", getpid(), i);
+	
+	snprintf(source, sizeof(source), "--source=%s", bench->slave_name);
+	
+	argc = 0;
+	argv[argc++] = bench->sertee;
+	argv[argc++] = source;
+	argv[argc++] = names;
+	argv[argc++] = "--raw";
+	argv[argc++] = "-f";
+	argv[argc++] = "-s";
+	for (i=0; i < (unsigned int) bench->n_extra; i++)
+		argv[argc++] = bench->extra[i];
+	argv[argc] = 0;
+	
+	rv = posix_spawn(&bench->pid, bench->sertee, 0, 0, argv, environ);
+	free(names);
+	if (rv) {
+		fprintf(stderr, "starting %s failed: %s\n", bench->sertee, strerror(rv));
+		return -1;
+	}
+	
+	// wait up to 5 seconds for the devices
+	deadline = bench_mono() + 5000000000ULL;
+	for (i=0; i < bench->n_readers; ) {
+		if (waitpid(bench->pid, &status, WNOHANG) == bench->pid) {
+			fprintf(stderr, "sertee exited before creating the devices\n");
+			bench->pid = 0;
+			return -1;
+		}
+		
+		if (access(bench->readers[i].path, R_OK) == 0) {
+			i++;
+			continue;
+		}
+		
+		if (bench_mono() > deadline) {
+			fprintf(stderr, "%s did not appear\n", bench->readers[i].path);
+			return -1;
+		}
+		usleep(10000);
+	}
+	
+	return 0;
+}
+
+// CPU time of a process in seconds
+static double bench_cpu(pid_t pid) {
+	unsigned long utime, stime;
+	char path[64], buf[1024], *p;
+	ssize_t len;
+	int fd;
+	
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return 0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buf[len] = 0;
+	
+	// the name may contain spaces, the other fields follow its ')'
+	p = strrchr(buf, ')');
+	if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+		return 0;
+	
+	return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// write one step and wait for the readers
+static int bench_step(struct bench *bench, struct bench_step *step) {
+	struct bench_reader *reader;
+	struct bench_counts *c;
+	double cpu_start;
+	unsigned int i;
+	int rv;
+	
+	for (i=0; i < bench->n_readers; i++)
+		bench->readers[i].step = bench->readers[i].counts;
+	
+	cpu_start = bench_cpu(bench->pid);
+	if (bench->replay)
+		rv = bench_replay(bench, step);
+	else
+		rv = bench_write(bench, step);
+	
+	usleep(bench->drain * 1000);
+	step->cpu = bench_cpu(bench->pid) - cpu_start;
+	
+	bench->sent += step->sent;
+	bench->elapsed += step->elapsed;
+	bench->cpu += step->cpu;
+	
+	for (i=0; i < bench->n_readers; i++) {
+		reader = &bench->readers[i];
+		c = &step->counts[i];
+		
+		c->bytes = reader->counts.bytes - reader->step.bytes;
+		c->frames = reader->counts.frames - reader->step.frames;
+		c->missed = reader->counts.missed - reader->step.missed;
+		c->duplicates = reader->counts.duplicates - reader->step.duplicates;
+		c->reordered = reader->counts.reordered - reader->step.reordered;
+		c->corrupt = reader->counts.corrupt - reader->step.corrupt;
+		
+		// frames that are still missing after the drain are lost as well
+		if (c->missed || c->duplicates || c->reordered || c->corrupt || reader->next_seq < bench_frames(bench))
+			step->loss = 1;
+	}
+	
+	return rv;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(uint64_t *samples, uint64_t n, double p) {
+	uint64_t i;
+	
+	if (n == 0)
+		return 0;
+	
+	i = (uint64_t) (p * (n - 1) + 0.5);
+	
+	return samples[i] / 1e3;
+}
+
+static void report_counts_json(struct bench_counts *c) {
+	printf("\"bytes\": %" PRIu64 ", \"frames\": %" PRIu64 ", \"missed\": %" PRIu64 ", \"duplicates\": %" PRIu64
+		", \"reordered\": %" PRIu64 ", \"corrupt\": %" PRIu64, c->bytes, c->frames, c->missed, c->duplicates,
+		c->reordered, c->corrupt);
+}
+
+static void bench_report_json(struct bench *bench, int64_t loss_rate) {
+	struct bench_reader *reader;
+	struct bench_step *step;
+	uint64_t n;
+	unsigned int i, j;
+	size_t g;
+	
+	printf("{\n");
+	printf("  \"frame_size\": %zu, \"readers\": %u, \"chunk_min\": %zu, \"chunk_max\": %zu, \"burst\": %u,\n",
+		sizeof(struct bench_rec), bench->n_readers, bench->chunk_min, bench->chunk_max, bench->burst);
+	printf("  \"sent\": %" PRIu64 ", \"frames\": %" PRIu64 ", \"seconds\": %.3f, \"cpu\": %.3f,\n",
+		bench->sent, bench_frames(bench), bench->elapsed / 1e9, bench->cpu);
+	if (loss_rate < 0)
+		printf("  \"loss_rate\": null,\n");
+	else
+		printf("  \"loss_rate\": %" PRId64 ",\n", loss_rate);
+	
+	printf("  \"steps\": [\n");
+	for (i=0; i < bench->steps_done; i++) {
+		step = &bench->steps[i];
+		
+		printf("    { \"rate\": %" PRIu64 ", \"sent\": %" PRIu64 ", \"chunks\": %" PRIu64 ", \"seconds\": %.3f"
+			", \"cpu\": %.3f, \"loss\": %s, \"readers\": [\n", step->rate, step->sent, step->chunks,
+			step->elapsed / 1e9, step->cpu, step->loss ? "true" : "false");
+		for (j=0; j < bench->n_readers; j++) {
+			printf("      { ");
+			report_counts_json(&step->counts[j]);
+			printf(" }%s\n", j + 1 < bench->n_readers ? "," : "");
+		}
+		printf("    ] }%s\n", i + 1 < bench->steps_done ? "," : "");
+	}
+	printf("  ],\n");
+	
+	printf("  \"totals\": [\n");
+	for (i=0; i < bench->n_readers; i++) {
+		reader = &bench->readers[i];
+		n = reader->n_samples < BENCH_MAX_SAMPLES ? reader->n_samples : BENCH_MAX_SAMPLES;
+		
+		printf("    { \"device\": \"%s\", ", reader->path);
+		report_counts_json(&reader->counts);
+		printf(", \"lost\": %" PRIu64 ", \"overruns\": %" PRIu64 ",\n", reader->lag.lost, reader->lag.overruns);
+		printf("      \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f,\n",
+			percentile_us(reader->samples, n, 0.5), percentile_us(reader->samples, n, 0.9),
+			percentile_us(reader->samples, n, 0.99), percentile_us(reader->samples, n, 0.999),
+			n ? reader->samples[n - 1] / 1e3 : 0);
+		
+		// stream byte ranges [start, end) the reader did not receive
+		printf("      \"missed_ranges\": [");
+		for (g=0; g < reader->n_gaps; g++)
+			printf("%s[%" PRIu64 ", %" PRIu64 "]", g ? ", " : "",
+				reader->gaps[g].start * sizeof(struct bench_rec), reader->gaps[g].end * sizeof(struct bench_rec));
+		printf("], \"missed_ranges_truncated\": %s }%s\n", reader->gaps_truncated ? "true" : "false",
+			i + 1 < bench->n_readers ? "," : "");
+	}
+	printf("  ]\n");
+	printf("}\n");
+}
+
+static void bench_report(struct bench *bench, int64_t loss_rate) {
+	struct bench_reader *reader;
+	struct bench_step *step;
+	uint64_t delivered, n;
+	double secs;
+	unsigned int i;
+	size_t g;
+	
+	secs = bench->elapsed / 1e9;
+	delivered = 0;
+	for (i=0; i < bench->n_readers; i++)
+		delivered += bench->readers[i].counts.bytes;
+	
+	if (bench->ramp) {
+		for (i=0; i < bench->steps_done; i++) {
+			step = &bench->steps[i];
+			printf("step %u: %" PRIu64 " B/s target, %.0f B/s written, %s\n", i, step->rate,
+				step->elapsed ? step->sent * 1e9 / step->elapsed : 0, step->loss ? "loss" : "no loss");
+		}
+		if (loss_rate < 0)
+			printf("no loss up to %" PRIu64 " B/s\n", bench->steps[bench->steps_done - 1].rate);
+		else
+			printf("loss starts at %" PRId64 " B/s\n", loss_rate);
+	}
+	
+	printf("source: %" PRIu64 " bytes in %" PRIu64 " frames, %.2f s, %.0f B/s\n",
+		bench->sent, bench_frames(bench), secs, secs > 0 ? bench->sent / secs : 0);
+	printf("sertee cpu: %.3f s, %.1f ns per source byte, %.1f ns per delivered byte\n",
+		bench->cpu, bench->sent ? bench->cpu * 1e9 / bench->sent : 0, delivered ? bench->cpu * 1e9 / delivered : 0);
+	printf("%-6s %12s %10s %10s %8s %8s %6s %6s %8s %10s %10s %10s %10s %10s\n", "reader", "bytes", "B/s", "lost",
+		"overruns", "missed", "dup", "reord", "corrupt", "p50_us", "p90_us", "p99_us", "p999_us", "max_us");
+	
+	for (i=0; i < bench->n_readers; i++) {
+		reader = &bench->readers[i];
+		
+		n = reader->n_samples < BENCH_MAX_SAMPLES ? reader->n_samples : BENCH_MAX_SAMPLES;
+		
+		printf("%-6u %12" PRIu64 " %10.0f %10" PRIu64 " %8" PRIu64 " %8" PRIu64 " %6" PRIu64 " %6" PRIu64 " %8" PRIu64
+			" %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			i, reader->counts.bytes, secs > 0 ? reader->counts.bytes / secs : 0,
+			reader->lag.lost, reader->lag.overruns, reader->counts.missed, reader->counts.duplicates,
+			reader->counts.reordered, reader->counts.corrupt,
+			percentile_us(reader->samples, n, 0.5), percentile_us(reader->samples, n, 0.9),
+			percentile_us(reader->samples, n, 0.99), percentile_us(reader->samples, n, 0.999),
+			n ? reader->samples[n - 1] / 1e3 : 0);
+		
+		for (g=0; g < reader->n_gaps && g < 8; g++)
+			printf("       missed bytes %" PRIu64 "-%" PRIu64 "\n", reader->gaps[g].start * sizeof(struct bench_rec),
+				reader->gaps[g].end * sizeof(struct bench_rec) - 1);
+		if (reader->n_gaps > 8 || reader->gaps_truncated)
+			printf("       ... see --json for all ranges\n");
+	}
+}
+
+int main(int argc, char **argv) {
+	static const struct option long_opts[] = {
+		{ "help", no_argument, 0, 'h' },
+		{ "sertee", required_argument, 0, 's' },
+		{ "readers", required_argument, 0, 'n' },
+		{ "rate", required_argument, 0, 'r' },
+		{ "chunk", required_argument, 0, 'c' },
+		{ "burst", required_argument, 0, 'b' },
+		{ "duration", required_argument, 0, 'd' },
+		{ "drain", required_argument, 0, 'D' },
+		{ "ramp", required_argument, 0, 'R' },
+		{ "steps", required_argument, 0, 'S' },
+		{ "json", no_argument, 0, 'j' },
+		{ "replay", required_argument, 0, 'p' },
+		{ "replay-source", required_argument, 0, 'P' },
+		{ "speed", required_argument, 0, 'x' },
+		{ 0, 0, 0, 0 },
+	};
+	struct bench bench;
+	struct bench_reader *reader;
+	struct bench_step *step;
+	int64_t loss_rate;
+	unsigned int i;
+	int opt, rv, status;
+	
+	memset(&bench, 0, sizeof(bench));
+	bench.sertee = "./sertee";
+	bench.n_readers = 4;
+	bench.rate = 11520;
+	bench.n_steps = 10;
+	bench.chunk_min = bench.chunk_max = 64;
+	bench.burst = 1;
+	bench.duration = 10;
+	bench.drain = 1000;
+	bench.rng = 0x9e3779b97f4a7c15ULL;
+	bench.speed = 1;
+	
+	while ((opt = getopt_long(argc, argv, "h", long_opts, 0)) != -1) {
+		switch (opt) {
+			case 's': bench.sertee = optarg; break;
+			case 'n': bench.n_readers = strtoul(optarg, 0, 0); break;
+			case 'r': bench.rate = strtoull(optarg, 0, 0); break;
+			case 'c':
+				if (sscanf(optarg, "%zu-%zu", &bench.chunk_min, &bench.chunk_max) == 1)
+					bench.chunk_max = bench.chunk_min;
+				break;
+			case 'b': bench.burst = strtoul(optarg, 0, 0); break;
+			case 'd': bench.duration = strtoul(optarg, 0, 0); break;
+			case 'D': bench.drain = strtoul(optarg, 0, 0); break;
+			case 'R': bench.ramp = strtoull(optarg, 0, 0); break;
+			case 'S': bench.n_steps = strtoul(optarg, 0, 0); break;
+			case 'j': bench.json = 1; break;
+			case 'p': bench.replay = optarg; break;
+			case 'P': bench.replay_source = optarg; break;
+			case 'x': bench.speed = strtod(optarg, 0); break;
+			case 'h':
+				show_help(stdout);
+				return 0;
+			default:
+				show_help(stderr);
+				return 1;
+		}
+	}
+	bench.extra = argv + optind;
+	bench.n_extra = argc - optind;
+	
+	if (bench.n_readers == 0 || bench.chunk_min == 0 || bench.chunk_max < bench.chunk_min || bench.burst == 0 ||
+		(bench.ramp && (bench.rate == 0 || bench.n_steps == 0 || bench.replay)) || bench.speed < 0)
+	{
+		fprintf(stderr, "error, invalid options\n");
+		return 1;
+	}
+	if (!bench.ramp)
+		bench.n_steps = 1;
+	
+	bench.steps = (struct bench_step *) calloc(bench.n_steps, sizeof(struct bench_step));
+	if (!bench.steps)
+		return 1;
+	for (i=0; i < bench.n_steps; i++) {
+		bench.steps[i].rate = bench.rate + i * bench.ramp;
+		bench.steps[i].counts = (struct bench_counts *) calloc(bench.n_readers, sizeof(struct bench_counts));
+		if (!bench.steps[i].counts)
+			return 1;
+	}
+	
+	bench.readers = (struct bench_reader *) calloc(bench.n_readers, sizeof(struct bench_reader));
+	if (!bench.readers)
+		return 1;
+	for (i=0; i < bench.n_readers; i++) {
+		reader = &bench.readers[i];
+		
+		reader->bench = &bench;
+		reader->id = i;
+		reader->fd = -1;
+		reader->rng = bench_mono() | 1;
+		if (asprintf(&reader->path, "/dev/sertee-bench-%d-%u", getpid(), i) < 0)
+			return 1;
+		reader->samples = (uint64_t *) malloc(sizeof(uint64_t) * BENCH_MAX_SAMPLES);
+		reader->gaps = (struct bench_gap *) malloc(sizeof(struct bench_gap) * BENCH_MAX_GAPS);
+		if (!reader->samples || !reader->gaps)
+			return 1;
+	}
+	
+	signal(SIGPIPE, SIG_IGN);
+	
+	rv = 0;
+	if (bench.replay)
+		rv = bench_load_capture(&bench);
+	if (rv == 0)
+		rv = bench_pty(&bench);
+	if (rv == 0)
+		rv = bench_start_sertee(&bench);
+	
+	for (i=0; rv == 0 && i < bench.n_readers; i++) {
+		reader = &bench.readers[i];
+		
+		reader->fd = open(reader->path, O_RDONLY | O_NONBLOCK);
+		if (reader->fd == -1) {
+			fprintf(stderr, "opening %s failed: %s\n", reader->path, strerror(errno));
+			rv = -1;
+			break;
+		}
+		
+		rv = pthread_create(&reader->thread, 0, reader_thread, reader);
+	}
+	
+	loss_rate = -1;
+	while (rv == 0 && bench.steps_done < bench.n_steps) {
+		step = &bench.steps[bench.steps_done++];
+		
+		rv = bench_step(&bench, step);
+		if (step->loss) {
+			loss_rate = step->rate;
+			break;
+		}
+	}
+	
+	bench.stop = 1;
+	for (i=0; i < bench.n_readers; i++) {
+		reader = &bench.readers[i];
+		
+		if (reader->thread)
+			pthread_join(reader->thread, 0);
+		if (reader->fd != -1) {
+			ioctl(reader->fd, SERTEE_IOC_GET_LAG, &reader->lag);
+			close(reader->fd);
+		}
+		
+		// frames after the last received one never arrived
+		if (rv == 0 && reader->next_seq < bench_frames(&bench)) {
+			reader_add_gap(reader, reader->next_seq, bench_frames(&bench));
+			reader->next_seq = bench_frames(&bench);
+		}
+		
+		qsort(reader->samples, reader->n_samples < BENCH_MAX_SAMPLES ? reader->n_samples : BENCH_MAX_SAMPLES,
+			sizeof(uint64_t), cmp_u64);
+	}
+	
+	if (bench.pid) {
+		kill(bench.pid, SIGTERM);
+		waitpid(bench.pid, &status, 0);
+	}
+	
+	if (rv == 0) {
+		if (bench.json)
+			bench_report_json(&bench, loss_rate);
+		else
+			bench_report(&bench, loss_rate);
+	}
+	
+	return rv ? 1 : 0;
+}
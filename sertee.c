@@ -12,13 +12,33 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <signal.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/serial.h>
+#include <termios.h>
 #include <poll.h>
+#include <spawn.h>
 
 #define FUSE_USE_VERSION 34
 
@@ -26,76 +46,1003 @@
 #include <fuse_opt.h>
 #include <fuse.h>
 
-#ifdef DEBUG
-#define DBG(fmt, ...) do { printf(fmt, ##__VA_ARGS__); } while (0)
+#include "sertee.h"
+#include "libsertee.h"
+
+// static probes for perf or bpftrace, e.g. "bpftrace -l 'usdt:./sertee:*'".
+// A disabled probe is a single nop.
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define TRACE(...) STAP_PROBEV(sertee, __VA_ARGS__)
 #else
-#define DBG(fmt, ...) do { } while (0)
+#define TRACE(...) do { } while (0)
 #endif
 
+#define container_of(ptr, type, member) ((type *) ((char *) (ptr) - offsetof(type, member)))
+
 #define STRINGIFYB(x) #x
 #define STRINGIFY(x) STRINGIFYB(x)
 
 #define DEFAULT_BUFSIZE 1024
+#define DEFAULT_REBALANCE_INTERVAL 10
+#define BROADCAST_REPORT_SIZE 4096
+#define DEFAULT_MONITOR_SIZE 65536
+#define CAPTURE_BATCH_SIZE (256 * 1024)
+#define CAPTURE_BATCHES 8
+#define CAPTURE_FLUSH_INTERVAL 1000
+#define DEFAULT_MODEM_CACHE 100
+#define DEFAULT_RECONNECT_INTERVAL 1000
+#define METRICS_MAX_CONNS 4
+#define METRICS_REQUEST_SIZE 2048
+#define METRICS_HEADER_SIZE 128
+#define DEFAULT_EVENTS_SIZE 65536
+// clients may exceed their rate limit by the amount of this time
+#define RATE_BURST_NS 1000000000ULL
+// number of one second slots of the byte rate window of a source
+#define LIVENESS_SLOTS 60
+#define ALARM_LOG_SIZE 16384
+// alarm records per source that may wait for the first shard at the same time
+#define ALARM_RECORDS 4
+// recycled objects are sorted into power of two size classes from
+// CACHE_LINE_SIZE up to CACHE_LINE_SIZE << (POOL_CLASSES - 1)
+#define POOL_CLASSES 13
+#define DEFAULT_POOL_CACHE 64
+// rings taken from the memory budget are multiples of this size
+#define ARENA_CHUNK_SIZE 4096
+// a grown ring shrinks after its readers stayed this many seconds below a
+// quarter of it
+#define ARENA_SHRINK_DELAY 60
+// bytes per simulated read of a generator source
+#define DEFAULT_GEN_CHUNK 256
+#define GEN_MAX_RECORD 256
+
+// latency histograms in nanoseconds: values below 2^HIST_SUB_BITS have their
+// own bucket, larger ones are split into 2^HIST_SUB_BITS buckets per power of
+// two, i.e. a relative error of at most 12.5% up to 2^HIST_MAX_BITS ns (~18 min)
+#define HIST_SUB_BITS 3
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * (1 << HIST_SUB_BITS))
+
+// counters have a single writer (the thread owning the object), other
+// threads only take relaxed snapshots
+#define COUNTER_ADD(c, n) __atomic_store_n(&(c), (c) + (n), __ATOMIC_RELAXED)
+#define COUNTER_GET(c) __atomic_load_n(&(c), __ATOMIC_RELAXED)
+#define COUNTER_MAX(c, n) do { if ((n) > (c)) __atomic_store_n(&(c), (n), __ATOMIC_RELAXED); } while (0)
+
+// counters of objects that belong to different shards are kept in separate
+// cache lines, objects containing them are allocated with sertee_zalloc()
+#define CACHE_LINE_SIZE 64
+
+struct sertee_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+// types of the records in the binary event log, the arguments of each type
+// are listed in event_descs
+enum sertee_event_type {
+	EV_SOURCE_READ,
+	EV_OVERRUN,
+	EV_NOTIFY,
+	EV_DISCONNECT,
+	EV_RECONNECT,
+	EV_OPEN,
+	EV_RELEASE,
+	EV_READ,
+	EV_READ_PARK,
+	EV_WRITE,
+	EV_WRITE_DONE,
+	EV_IOCTL,
+	EV_POLL,
+	EV_BROADCAST,
+	EV_MIGRATE,
+	EV_THROTTLE_READ,
+	EV_THROTTLE_WRITE,
+	EV_ALARM,
+	EV_RESIZE,
+	EV_MAX,
+};
+
+// a record of the binary event log. Records are only copied on the hot path
+// and formatted later by "sertee --decode-events".
+struct sertee_event {
+	uint64_t ts;
+	uint32_t type;
+	// index into the name table of the log
+	uint32_t id;
+	uint64_t a;
+	uint64_t b;
+	uint64_t c;
+};
+
+// header of the event log file, followed by the name table and one ring per
+// shard, each starting at a cache line
+#define EVENTS_MAGIC "SRTEVT1"
+#define EVENTS_NAME_SIZE 64
+
+struct event_log_hdr {
+	char magic[8];
+	uint32_t n_shards;
+	uint32_t n_records;
+	uint32_t n_names;
+	uint32_t reserved;
+};
+
+// the records of a ring follow this header. head counts all records ever
+// written and is only changed by the thread of the shard.
+struct event_ring {
+	uint64_t head;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
 
 struct sertee;
+struct sertee_source;
+struct sertee_shard;
+struct sertee_write_op;
+struct capture_batch;
+struct sertee_tsdev;
+struct sertee_handle;
+
+// every object registered with epoll starts with its type so the event
+// loop knows how to dispatch it
+enum sertee_obj_type {
+	SERTEE_OBJ_SOURCE,
+	SERTEE_OBJ_DEV,
+	SERTEE_OBJ_SHARD,
+	SERTEE_OBJ_BROADCAST,
+	SERTEE_OBJ_MONITOR,
+	SERTEE_OBJ_TSDEV,
+	SERTEE_OBJ_SOURCE_TIMER,
+	SERTEE_OBJ_STATS,
+	SERTEE_OBJ_METRICS,
+	SERTEE_OBJ_METRICS_CONN,
+	SERTEE_OBJ_ALARM,
+};
+
+// a timer of a source, fn is called by the thread that owns the source
+struct sertee_timer {
+	struct sertee_timer *next;
+	uint64_t deadline;
+	char armed;
+	
+	void (*fn)(struct sertee_timer *timer);
+};
 
 struct sertee_dev {
+	enum sertee_obj_type type;
+	struct sertee_source *source;
+	
+	// index in the name table of the event log
+	unsigned int id;
+	
+	char *name;
+	const char *dev_name;
+	
+	const char *dev_info_argv[1];
+	struct cuse_info ci;
+	struct fuse_session *fsess;
+	struct epoll_event eevent;
+	
+	// number of open files, each has its own cursor in the ring of the source
+	unsigned int n_clients;
+	
+	// handles with a read request that waits for more data
+	struct sertee_handle *parked;
+	
+	// POLLIN is only signaled if this many bytes are available
+	uint32_t lowat;
+	
+	struct sertee_tsdev *tsdev;
+	
+	// open files, only changed under handles_lock to allow the stats device
+	// to walk the list from another thread
+	struct sertee_handle *handles;
+	pthread_mutex_t handles_lock;
+	
+	struct {
+		uint64_t reads;
+		uint64_t bytes_read;
+		uint64_t writes;
+		uint64_t bytes_written;
+		uint64_t polls;
+		uint64_t notifications;
+		uint64_t parked;
+		uint64_t lag;
+		uint64_t lag_max;
+		uint64_t lost;
+		uint64_t overruns;
+	} stats __attribute__((aligned(CACHE_LINE_SIZE)));
+	
+	// time from the arrival of the oldest unread byte until a read returns
+	// it or until the poll notification
+	struct sertee_hist read_latency;
+	struct sertee_hist notify_latency;
+};
+
+// the termios structure used by the TCGETS/TCSETS ioctls of the kernel which
+// is different from the struct termios of the C library
+#define KERNEL_NCCS 19
+struct sertee_ktermios {
+	tcflag_t c_iflag;
+	tcflag_t c_oflag;
+	tcflag_t c_cflag;
+	tcflag_t c_lflag;
+	cc_t c_line;
+	cc_t c_cc[KERNEL_NCCS];
+};
+
+// a process that opened one or more devices of a source. It exists as long
+// as it has open files or throttled writes.
+struct sertee_client {
+	struct sertee_source *source;
+	struct sertee_client *prev;
+	struct sertee_client *next;
+	
+	uint32_t pid;
+	uint32_t uid;
+	unsigned int n_handles;
+	
+	// theoretical arrival times of the next read request and write for the
+	// rate limits, see client_rate_wait()
+	uint64_t read_tat;
+	uint64_t write_tat;
+	
+	// writes that wait for the rate limit
+	struct sertee_write_op *throttled_head;
+	struct sertee_write_op *throttled_tail;
+	struct sertee_timer timer;
+	
+	struct {
+		uint64_t reads;
+		uint64_t bytes_read;
+		uint64_t writes;
+		uint64_t bytes_written;
+		uint64_t lag_max;
+		uint64_t throttled_reads;
+		uint64_t throttled_writes;
+	} stats __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+// an open file of a device
+struct sertee_handle {
+	struct sertee_dev *dev;
+	struct sertee_client *client;
+	
+	// read position in the ring of the source, every open file reads all data
+	struct sertee_cursor cursor;
+	struct fuse_pollhandle *poll_handle;
+	
+	// termios-like read batching, vtime is in tenths of a second
+	uint8_t vmin;
+	uint8_t vtime;
+	
+	// read request that waits for VMIN bytes or the VTIME timer
+	fuse_req_t req;
+	size_t req_size;
+	size_t req_lag;
+	struct sertee_timer timer;
+	struct sertee_handle *next_parked;
+	
+	struct sertee_handle *prev;
+	struct sertee_handle *next;
+	
+	struct {
+		uint32_t pid;
+		uint64_t reads;
+		uint64_t bytes_read;
+		uint64_t writes;
+		uint64_t bytes_written;
+		uint64_t polls;
+		uint64_t lag_max;
+	} stats __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+// header of a record returned by a timestamp device, followed by the payload
+struct sertee_ts_rec {
+	uint64_t ts;
+	uint64_t offset;
+	uint32_t len;
+	uint32_t reserved;
+};
+
+enum gen_pattern {
+	GEN_COUNTER,
+	GEN_TEXT,
+	GEN_BINARY,
+	GEN_PATTERNS,
+};
+
+static const char *gen_pattern_names[] = {
+	"counter",
+	"text",
+	"binary",
+};
+
+// a source that produces data itself instead of reading a device, selected
+// with --source=gen:PATTERN[:rate=BPS][:chunk=N][:burst=N]
+struct sertee_gen {
+	enum gen_pattern pattern;
+	
+	// bytes per second, 0 produces data as fast as possible
+	uint64_t rate;
+	// bytes per simulated read and reads per burst
+	size_t chunk;
+	unsigned int burst;
+	
+	// CLOCK_MONOTONIC when the source was opened and the bytes produced
+	// since then
+	uint64_t start;
+	uint64_t generated;
+	
+	uint64_t seq;
+	uint64_t rng;
+	
+	// the record that is currently emitted
+	char rec[GEN_MAX_RECORD];
+	size_t rec_len;
+	size_t rec_pos;
+};
+
+// arrival time of the chunk that starts at the absolute offset off
+struct ts_chunk {
+	uint64_t off;
+	uint64_t ts;
+};
+
+// an open file of a timestamp device
+struct tsdev_reader {
+	struct tsdev_reader *prev;
+	struct tsdev_reader *next;
+	
+	struct fuse_pollhandle *poll_handle;
+	
+	// absolute offset of the reader and the rendered records
+	uint64_t pos;
+	char *out;
+	size_t out_size;
+	size_t out_len;
+	size_t out_off;
+};
+
+// a device that returns the data of a device as records with the arrival
+// time and the absolute offset of every chunk
+struct sertee_tsdev {
+	enum sertee_obj_type type;
+	struct sertee_source *source;
+	
+	char *name;
+	const char *dev_info_argv[1];
+	struct cuse_info ci;
+	struct fuse_session *fsess;
+	struct epoll_event eevent;
+	
+	char json;
+	
+	struct tsdev_reader *readers;
+};
+
+enum monitor_dir {
+	MONITOR_PAD,
+	MONITOR_RX,
+	MONITOR_TX,
+};
+
+// header of a chunk in the ring of a monitor device, followed by the payload
+struct monitor_rec {
+	uint64_t ts;
+	const char *origin;
+	uint32_t pid;
+	uint16_t len;
+	uint8_t dir;
+	uint8_t reserved;
+};
+
+// an open file of a monitor device
+struct monitor_reader {
+	struct monitor_reader *prev;
+	struct monitor_reader *next;
+	
+	struct fuse_pollhandle *poll_handle;
+	
+	// position of the reader and the record it currently reads
+	uint64_t pos;
+	char *line;
+	size_t line_len;
+	size_t line_off;
+};
+
+// a device that shows the data of a source in both directions
+struct sertee_monitor {
+	enum sertee_obj_type type;
+	struct sertee_source *source;
+	
+	char *name;
+	const char *dev_info_argv[1];
+	struct cuse_info ci;
+	struct fuse_session *fsess;
+	struct epoll_event eevent;
+	
+	// ring of records, head and tail are absolute offsets
+	char *buf;
+	size_t size;
+	uint64_t head;
+	uint64_t tail;
+	
+	struct monitor_reader *readers;
+};
+
+// a device that returns a snapshot of the counters of all sources, devices
+// and open files
+struct sertee_statsdev {
+	enum sertee_obj_type type;
+	struct sertee *sertee;
+	
+	char *name;
+	const char *dev_info_argv[1];
+	struct cuse_info ci;
+	struct fuse_session *fsess;
+	struct epoll_event eevent;
+};
+
+enum alarm_kind {
+	ALARM_STALL,
+	ALARM_SATURATION,
+};
+
+// an alarm passed from the shard of a source to the first shard
+struct sertee_alarm {
+	struct sertee_source *source;
+	enum alarm_kind kind;
+	int active;
+	uint64_t value;
+	uint64_t ts;
+	
+	// set until the first shard reported the alarm
+	int busy;
+};
+
+// an open file of the alarm device
+struct alarm_reader {
+	struct alarm_reader *prev;
+	struct alarm_reader *next;
+	
+	uint64_t pos;
+	struct fuse_pollhandle *poll_handle;
+};
+
+// a device that reports the alarms of all sources as text lines. Every open
+// file returns the lines that were added after it was opened. The device is
+// always handled by the first shard.
+struct sertee_alarmdev {
+	enum sertee_obj_type type;
 	struct sertee *sertee;
 	
 	char *name;
+	const char *dev_info_argv[1];
+	struct cuse_info ci;
+	struct fuse_session *fsess;
+	struct epoll_event eevent;
+	
+	// ring of text lines, head is the number of bytes ever written
+	char log[ALARM_LOG_SIZE];
+	uint64_t head;
+	
+	struct alarm_reader *readers;
+};
+
+// the snapshot an open file of the stats device reads from
+struct stats_snapshot {
+	char *buf;
+	size_t len;
+	size_t pos;
+};
+
+struct sertee_metrics;
+
+// a client of the metrics listener
+struct metrics_conn {
+	enum sertee_obj_type type;
+	struct sertee_metrics *metrics;
+	
+	int fd;
+	struct epoll_event eevent;
+	
+	char req[METRICS_REQUEST_SIZE];
+	size_t req_len;
+	
+	// the response, the header is placed right in front of the body
+	char *out;
+	size_t out_start;
+	size_t out_len;
+	size_t out_off;
+};
+
+// HTTP listener for the Prometheus text format. All buffers are allocated at
+// startup, a scrape only formats numbers into them.
+struct sertee_metrics {
+	enum sertee_obj_type type;
+	struct sertee *sertee;
+	struct sertee_shard *shard;
+	
+	int fd;
+	struct epoll_event eevent;
+	
+	size_t out_size;
+	struct metrics_conn conns[METRICS_MAX_CONNS];
+	unsigned int next_conn;
+};
+
+// the part of a write operation that is queued for one source
+struct sertee_tx {
+	struct sertee_tx *next;
+	struct sertee_write_op *op;
+	struct sertee_source *source;
+	
+	size_t done;
+	int error;
+};
+
+// a write request of a client that is forwarded to one or more sources. The
+// request is answered once all sources processed their part.
+struct sertee_write_op {
+	fuse_req_t req;
+	struct sertee_broadcast *broadcast;
+	uint64_t seq;
+	
+	const char *origin;
+	uint32_t pid;
+	
+	// next write of a client that waits for its rate limit
+	struct sertee_write_op *next;
+	
+	char *data;
+	size_t size;
 	
+	unsigned int n_tx;
+	unsigned int n_pending;
+	struct sertee_tx tx[];
+};
+
+// a device whose writes are forwarded to a set of sources at once
+struct sertee_broadcast {
+	enum sertee_obj_type type;
+	struct sertee *sertee;
+	struct sertee_shard *shard;
+	
+	// index in the name table of the event log
+	unsigned int id;
+	
+	char *dev_name;
+	char *targets;
+	
+	struct sertee_source **sources;
+	unsigned int n_sources;
+	
+	char *name;
 	const char *dev_info_argv[1];
 	struct cuse_info ci;
 	struct fuse_session *fsess;
 	struct epoll_event eevent;
 	struct fuse_pollhandle *poll_handle;
 	
-	char *pos;
-	unsigned char round;
-	unsigned int n_clients;
+	uint64_t seq;
+	
+	// status lines of finished writes, consumed by reading the device
+	char report[BROADCAST_REPORT_SIZE];
+	size_t report_len;
 };
 
-struct sertee {
+// a source device and the group of devices that receive a copy of its output
+struct sertee_source {
+	enum sertee_obj_type type;
+	struct sertee *sertee;
+	
+	// index in sertee->sources, also used as pcapng interface ID and in the
+	// name table of the event log
+	unsigned int id;
+	
 	struct sertee_dev **devs;
 	unsigned int n_devs;
 	
 	char *source_name;
 	char *dev_names;
 	
-	int epoll_fd;
 	int source_fd;
 	
-	char *buf;
-	char *pos;
-	unsigned char round;
+	// set if the source is a generator, source_fd is a timerfd or eventfd
+	// that wakes it up
+	struct sertee_gen *gen;
+	
+	// every device reads the data of the source through a cursor
+	struct sertee_ring ring;
+	
+	// arrival times of the chunks in the buffer
+	struct ts_chunk *chunks;
+	unsigned int n_chunks;
+	uint64_t chunk_head;
+	char *timestamps;
+	
+	// defaults for the handles of the devices
+	unsigned int vmin;
+	unsigned int vtime;
+	
+	// rate limits for every client process, 0 means unlimited
+	unsigned int client_read_rate;
+	unsigned int client_write_rate;
+	
+	// processes that opened devices of this source, only changed under
+	// clients_lock to allow the stats device to walk the list
+	struct sertee_client *clients;
+	pthread_mutex_t clients_lock;
+	
+	// line settings that are applied after opening the source, -1 or 0
+	// keeps the current setting
+	unsigned int baud;
+	char *framing;
+	char *flow;
+	int raw;
+	int low_latency;
+	int source_vmin;
+	int source_vtime;
+	size_t read_chunk;
+	
+	// try to open the source again after this many milliseconds if it
+	// failed, 0 disables reconnecting
+	unsigned int reconnect;
+	struct sertee_timer reconnect_timer;
+	struct sertee_timer flush_timer;
+	
+	// raise an alarm if no data arrived for this many milliseconds or if the
+	// line is used to this percentage, 0 disables the alarm
+	unsigned int stall;
+	unsigned int saturation;
+	
+	// preallocated records of the alarms that are passed to the first shard
+	struct sertee_alarm alarms[ALARM_RECORDS];
+	unsigned int alarm_pos;
+	
+	// received bytes per second of the last LIVENESS_SLOTS seconds
+	struct sertee_timer liveness_timer;
+	uint64_t window[LIVENESS_SLOTS];
+	uint64_t window_pos;
+	uint64_t window_bytes;
+	
+	// timers ordered by their deadline and the timerfd that fires for the
+	// first one
+	struct sertee_timer *timers;
+	int timer_fd;
+	enum sertee_obj_type timer_type;
+	struct epoll_event timer_eevent;
 	
 	struct epoll_event source_eevent;
 	
-	char show_help;
+	// line settings and modem lines of the source as seen by the last
+	// access, clients are served from this copy
+	struct sertee_ktermios termios;
+	char termios_valid;
+	int modem;
+	uint64_t modem_ts;
+	unsigned int modem_cache;
+	
+	// data written by clients that the source did not accept yet
+	struct sertee_tx *tx_head;
+	struct sertee_tx *tx_tail;
+	
 	size_t bufsize;
+	
+	// with a memory budget, the ring grows up to bufsize_max while readers
+	// fall behind and shrinks back to bufsize_min once they caught up
+	size_t bufsize_min;
+	size_t bufsize_max;
+	uint64_t arena_overruns;
+	unsigned int arena_calm;
+	
+	char *monitor_name;
+	size_t monitor_size;
+	struct sertee_monitor *monitor;
+	
+	// the shard whose thread exclusively handles this source and its devices.
+	// Other shards read it to forward broadcast writes.
+	struct sertee_shard *shard;
+	struct sertee_shard *migrate_to;
+	int shard_id;
+	
+	// set between the detach from the old shard and the attach to the new one
+	char detached;
+	
+	// only used by the rebalancer
+	uint64_t rate_bytes;
+	uint64_t rate;
+	
+	struct {
+		uint64_t reads;
+		uint64_t bytes_in;
+		uint64_t writes;
+		uint64_t bytes_out;
+		uint64_t write_errors;
+		uint64_t disconnects;
+		
+		// updated every second by the liveness timer
+		uint64_t rate_1s;
+		uint64_t rate_10s;
+		uint64_t rate_60s;
+		uint64_t utilization;
+		uint64_t stalled;
+		uint64_t saturated;
+		
+		// arrival time of the last chunk
+		uint64_t last_rx;
+		
+		// size changes of the ring
+		uint64_t grows;
+		uint64_t shrinks;
+		uint64_t grow_failures;
+	} stats __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+// a command executed by the thread of a shard
+struct sertee_cmd {
+	void (*fn)(struct sertee_shard *shard, void *arg);
+	void *arg;
+};
+
+// an event loop running in its own thread. Sources and their devices are
+// owned by exactly one shard, hence no locking is required. Other threads
+// only talk to a shard by writing commands into its pipe.
+struct sertee_shard {
+	enum sertee_obj_type type;
+	struct sertee *sertee;
+	
+	unsigned int id;
+	int cpu;
+	pthread_t thread;
+	
+	int epoll_fd;
+	int cmd_fds[2];
+	struct epoll_event cmd_eevent;
+	
+	char stop;
+	
+	// only used by the rebalancer
+	uint64_t load;
+	
+	// parts of broadcast writes for sources of other shards and finished
+	// broadcast writes of other shards whose command did not fit into the
+	// pipe, the event loop sends them again in order
+	struct sertee_tx *tx_retry_head;
+	struct sertee_tx *tx_retry_tail;
+	struct sertee_write_op *op_retry_head;
+	struct sertee_write_op *op_retry_tail;
+	
+	// capture blocks that are not yet handed to the capture thread and
+	// batches the capture thread returned to us
+	struct capture_batch *capture_batch;
+	int capture_free_fds[2];
+	
+	// ring of the event log in the mapped file
+	struct event_ring *events;
+	uint64_t events_mask;
+	
+	// free objects of every size class, only touched by the thread of the
+	// shard. An object freed by another shard than the one that allocated
+	// it simply moves to the pool of that shard.
+	struct pool_obj *pool[POOL_CLASSES];
+	unsigned int pool_len[POOL_CLASSES];
+	
+	struct {
+		uint64_t allocations;
+		uint64_t frees;
+		uint64_t recycled;
+		uint64_t cached;
+		uint64_t capture_drops;
+	} stats __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+struct pool_obj {
+	struct pool_obj *next;
+};
+
+// memory shared by the rings of all sources, split into chunks of
+// ARENA_CHUNK_SIZE bytes. Rings are allocated and resized by the threads of
+// different shards, hence the lock.
+struct sertee_arena {
+	pthread_mutex_t lock;
+	char *mem;
+	size_t n_chunks;
+	uint64_t *used_map;
+	uint64_t used;
+};
+
+// a batch of pcapng blocks passed from a shard to the capture thread
+struct capture_batch {
+	struct sertee_shard *shard;
+	uint64_t first_ts;
+	size_t len;
+	unsigned int n_records;
+	char data[CAPTURE_BATCH_SIZE];
+};
+
+struct sertee {
+	struct sertee_source **sources;
+	unsigned int n_sources;
+	
+	struct sertee_broadcast **broadcasts;
+	unsigned int n_broadcasts;
+	
+	// source group given on the command line
+	struct sertee_source cli_source;
+	
+	char *config;
+	
+	struct fuse_args *args;
+	
+	struct sertee_shard *shards;
+	unsigned int n_shards;
+	char *cpus;
+	unsigned int rebalance_interval;
+	unsigned int pool_cache;
+	
+	size_t memory;
+	struct sertee_arena *arena;
+	
+	// shards report to the supervisor through this pipe
+	int supervisor_fds[2];
+	
+	char *capture;
+	int capture_fd;
+	pthread_t capture_thread;
+	int capture_fds[2];
+	
+	char *stats_name;
+	struct sertee_statsdev *statsdev;
+	
+	char *metrics_addr;
+	struct sertee_metrics *metrics;
+	
+	char *alarm_name;
+	char *alarm_exec;
+	struct sertee_alarmdev *alarmdev;
+	
+	char *events;
+	unsigned int events_size;
+	int events_on;
+	char *decode_events;
+	void *events_map;
+	size_t events_map_size;
+	
+	char show_help;
 };
 
 #define SERTEE_OPT(t, p) { t, offsetof(struct sertee, p), 1 }
 
 static const struct fuse_opt sertee_opts[] = {
-	SERTEE_OPT("-n %s", dev_names),
-	SERTEE_OPT("--name=%s", dev_names),
-	SERTEE_OPT("-S %s", source_name),
-	SERTEE_OPT("--source=%s", source_name),
-	SERTEE_OPT("--bufsize=%s", bufsize),
+	SERTEE_OPT("-c %s", config),
+	SERTEE_OPT("--config=%s", config),
+	SERTEE_OPT("--shards=%u", n_shards),
+	SERTEE_OPT("--cpus=%s", cpus),
+	SERTEE_OPT("--rebalance=%u", rebalance_interval),
+	SERTEE_OPT("--pool=%u", pool_cache),
+	SERTEE_OPT("--memory=%zu", memory),
+	SERTEE_OPT("--capture=%s", capture),
+	SERTEE_OPT("--stats=%s", stats_name),
+	SERTEE_OPT("--metrics=%s", metrics_addr),
+	SERTEE_OPT("--alarm=%s", alarm_name),
+	SERTEE_OPT("--alarm-exec=%s", alarm_exec),
+	SERTEE_OPT("--events=%s", events),
+	SERTEE_OPT("--events-size=%u", events_size),
+	SERTEE_OPT("--events-on", events_on),
+	SERTEE_OPT("--decode-events=%s", decode_events),
 	FUSE_OPT_KEY("-h", 0),
 	FUSE_OPT_KEY("--help", 0),
 	FUSE_OPT_END
 };
 
+// options of a source group, used for the command line as well as for the
+// lines of a config file
+#define SOURCE_OPT(t, p) { t, offsetof(struct sertee_source, p), 1 }
+
+static const struct fuse_opt sertee_source_opts[] = {
+	SOURCE_OPT("-n %s", dev_names),
+	SOURCE_OPT("--name=%s", dev_names),
+	SOURCE_OPT("-S %s", source_name),
+	SOURCE_OPT("--source=%s", source_name),
+	SOURCE_OPT("--bufsize=%zu", bufsize),
+	SOURCE_OPT("--bufsize-max=%zu", bufsize_max),
+	SOURCE_OPT("--shard=%d", shard_id),
+	SOURCE_OPT("--monitor=%s", monitor_name),
+	SOURCE_OPT("--monitor-size=%zu", monitor_size),
+	SOURCE_OPT("--timestamps=%s", timestamps),
+	SOURCE_OPT("--modem-cache=%u", modem_cache),
+	SOURCE_OPT("--vmin=%u", vmin),
+	SOURCE_OPT("--vtime=%u", vtime),
+	SOURCE_OPT("--client-read-rate=%u", client_read_rate),
+	SOURCE_OPT("--client-write-rate=%u", client_write_rate),
+	SOURCE_OPT("--baud=%u", baud),
+	SOURCE_OPT("--framing=%s", framing),
+	SOURCE_OPT("--flow=%s", flow),
+	SOURCE_OPT("--raw", raw),
+	SOURCE_OPT("--low-latency", low_latency),
+	SOURCE_OPT("--source-vmin=%d", source_vmin),
+	SOURCE_OPT("--source-vtime=%d", source_vtime),
+	SOURCE_OPT("--read-chunk=%zu", read_chunk),
+	SOURCE_OPT("--reconnect=%u", reconnect),
+	SOURCE_OPT("--stall=%u", stall),
+	SOURCE_OPT("--saturation=%u", saturation),
+	FUSE_OPT_END
+};
+
+#define BROADCAST_OPT(t, p) { t, offsetof(struct sertee_broadcast, p), 1 }
+
+static const struct fuse_opt sertee_broadcast_opts[] = {
+	BROADCAST_OPT("--broadcast=%s", dev_name),
+	BROADCAST_OPT("--targets=%s", targets),
+	FUSE_OPT_END
+};
+
 void show_help(FILE *fd) {
 	fprintf(fd, "usage: sertee [options]\n");
 	fprintf(fd, "\n");
 	fprintf(fd, "options:\n");
 	fprintf(fd, "    --help|-h             print this help message\n");
-	fprintf(fd, "    --name=NAME|-n NAME   device names (mandatory)\n");
-	fprintf(fd, "    --source=NAME|-S NAME source device name (mandatory)\n");
+	fprintf(fd, "    --config=FILE|-c FILE read source groups from FILE\n");
+	fprintf(fd, "    --name=NAME|-n NAME   device names (mandatory without --config)\n");
+	fprintf(fd, "    --source=NAME|-S NAME source device name (mandatory without --config), or\n");
+	fprintf(fd, "                          gen:PATTERN[:rate=BPS][:chunk=N][:burst=N] to generate\n");
+	fprintf(fd, "                          counter, text or binary data\n");
 	fprintf(fd, "    --bufsize=SIZE        size of internal buffer (default: " STRINGIFY(DEFAULT_BUFSIZE) " bytes)\n");
+	fprintf(fd, "    --bufsize-max=SIZE    let the buffer grow up to SIZE bytes with --memory\n");
+	fprintf(fd, "                          (default: 0, limited by the budget only)\n");
+	fprintf(fd, "    --monitor=NAME        create a device that shows the data in both directions\n");
+	fprintf(fd, "    --monitor-size=SIZE   size of the monitor buffer (default: " STRINGIFY(DEFAULT_MONITOR_SIZE) " bytes)\n");
+	fprintf(fd, "    --timestamps=bin|json create a NAME.ts device for every device that returns\n");
+	fprintf(fd, "                          the data with arrival timestamps\n");
+	fprintf(fd, "    --modem-cache=MS      serve TIOCMGET from a copy of the modem lines that is\n");
+	fprintf(fd, "                          at most MS milliseconds old (default: " STRINGIFY(DEFAULT_MODEM_CACHE) ")\n");
+	fprintf(fd, "    --vmin=N              default VMIN of the devices (see termios(3))\n");
+	fprintf(fd, "    --vtime=N             default VTIME of the devices in tenths of a second\n");
+	fprintf(fd, "    --client-read-rate=N  allow each process N read requests per second\n");
+	fprintf(fd, "    --client-write-rate=BPS\n");
+	fprintf(fd, "                          allow each process to write BPS bytes per second\n");
+	fprintf(fd, "    --baud=RATE           set the baud rate of the source\n");
+	fprintf(fd, "    --framing=8N1         set data bits, parity (N, E or O) and stop bits\n");
+	fprintf(fd, "    --flow=none|rtscts|xonxoff\n");
+	fprintf(fd, "                          set the flow control of the source\n");
+	fprintf(fd, "    --raw                 put the source into raw mode\n");
+	fprintf(fd, "    --low-latency         ask the serial driver for low latency\n");
+	fprintf(fd, "    --source-vmin=N       wake up only if N bytes were received ...\n");
+	fprintf(fd, "    --source-vtime=N      ... or N tenths of a second passed\n");
+	fprintf(fd, "    --read-chunk=SIZE     read at most SIZE bytes from the source at once\n");
+	fprintf(fd, "    --reconnect=MS        reopen the source after an error (default: " STRINGIFY(DEFAULT_RECONNECT_INTERVAL) " ms, 0: never)\n");
+	fprintf(fd, "    --stall=MS            raise an alarm if the source sent nothing for MS ms\n");
+	fprintf(fd, "    --saturation=PERCENT  raise an alarm if the source uses PERCENT of its line rate\n");
+	fprintf(fd, "    --shard=N             always handle this source in shard N\n");
+	fprintf(fd, "    --shards=N            number of event loop threads (default: 1)\n");
+	fprintf(fd, "    --cpus=LIST           comma-separated list of cores the shards are bound to\n");
+	fprintf(fd, "    --rebalance=SECONDS   interval to rebalance sources between shards by their\n");
+	fprintf(fd, "                          byte rate, 0 disables (default: " STRINGIFY(DEFAULT_REBALANCE_INTERVAL) ")\n");
+	fprintf(fd, "    --memory=SIZE         allocate the buffers of all sources from a budget of\n");
+	fprintf(fd, "                          SIZE bytes and resize them on demand\n");
+	fprintf(fd, "    --pool=N              keep up to N freed objects per size class and shard for\n");
+	fprintf(fd, "                          reuse (default: " STRINGIFY(DEFAULT_POOL_CACHE) ")\n");
+	fprintf(fd, "    --capture=FILE        write the data of all sources into a pcapng file\n");
+	fprintf(fd, "    --stats=NAME          create a device that shows the counters of all devices\n");
+	fprintf(fd, "    --metrics=unix:PATH|tcp:PORT\n");
+	fprintf(fd, "                          serve Prometheus metrics on a unix socket or local port\n");
+	fprintf(fd, "    --alarm=NAME          create a device that reports stalled and saturated sources\n");
+	fprintf(fd, "    --alarm-exec=CMD      run CMD with /bin/sh for every alarm\n");
+	fprintf(fd, "    --events=FILE         keep a binary log of internal events in FILE\n");
+	fprintf(fd, "    --events-size=N       number of events kept per shard (default: " STRINGIFY(DEFAULT_EVENTS_SIZE) ")\n");
+	fprintf(fd, "    --events-on           start logging immediately, SIGUSR1 toggles logging\n");
+	fprintf(fd, "    --decode-events=FILE  print the events logged in FILE and exit\n");
+	fprintf(fd, "\n");
+	fprintf(fd, "Every line of a config file describes one source group using the long\n");
+	fprintf(fd, "option names without leading dashes, e.g.:\n");
+	fprintf(fd, "    source=/dev/ttyUSB0 name=uart0,uart1 bufsize=4096\n");
+	fprintf(fd, "\n");
+	fprintf(fd, "A line can also describe a broadcast device whose writes are forwarded to\n");
+	fprintf(fd, "multiple sources (default: all sources), e.g.:\n");
+	fprintf(fd, "    broadcast=sync targets=/dev/ttyUSB0,/dev/ttyUSB1\n");
 	fprintf(fd, "\n");
 }
 
@@ -120,284 +1067,5126 @@ static int sertee_process_arg(void *data, const char *arg, int key, struct fuse_
 	return 0;
 }
 
-static void sertee_open(fuse_req_t req, struct fuse_file_info *fi) {
-	struct sertee_dev *sertee_dev = (struct sertee_dev *) fuse_req_userdata(req);
+// zeroed memory that starts at a cache line
+static void *sertee_zalloc(size_t size) {
+	void *ptr;
 	
-	DBG("OPEN: %s\n", sertee_dev->name);
+	if (posix_memalign(&ptr, CACHE_LINE_SIZE, size))
+		return 0;
+	memset(ptr, 0, size);
 	
-	sertee_dev->pos = sertee_dev->sertee->pos;
-	// if buffer contains only valid data, allow client to read the old data
-	sertee_dev->round = sertee_dev->sertee->round - (sertee_dev->sertee->round > 0 ? 1 : 0);
-	sertee_dev->n_clients += 1;
+	return ptr;
+}
+
+// toggled by SIGUSR1, only read on the hot path
+static volatile sig_atomic_t sertee_events_on;
+
+// copy an event into the ring of the shard, the oldest events are overwritten
+static void event_log(struct sertee_shard *shard, enum sertee_event_type type, uint32_t id,
+					  uint64_t a, uint64_t b, uint64_t c)
+{
+	struct event_ring *ring = shard->events;
+	struct sertee_event *ev;
+	struct timespec ts;
 	
-	fuse_reply_open(req, fi);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	
+	ev = (struct sertee_event *) (ring + 1) + (ring->head & shard->events_mask);
+	ev->ts = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	ev->type = type;
+	ev->id = id;
+	ev->a = a;
+	ev->b = b;
+	ev->c = c;
+	
+	// a reader of the file only decodes records below head
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
 }
 
-static void sertee_release(fuse_req_t req, struct fuse_file_info *fi) {
-	struct sertee_dev *sertee_dev = (struct sertee_dev *) fuse_req_userdata(req);
+// the event log is always compiled in, a disabled log costs a single branch
+#define EVENT(shard, type, id, a, b, c) do { \
+		if (__builtin_expect(sertee_events_on, 0)) \
+			event_log(shard, type, id, a, b, c); \
+	} while (0)
+
+static int pool_class(size_t size) {
+	int c;
 	
-	DBG("RELEASE: %s\n", sertee_dev->name);
+	for (c=0; c < POOL_CLASSES; c++) {
+		if (size <= (size_t) CACHE_LINE_SIZE << c)
+			return c;
+	}
 	
-	sertee_dev->n_clients -= 1;
-	if (sertee_dev->n_clients <= 0) {
-		sertee_dev->pos = 0;
-		sertee_dev->n_clients = 0;
+	return -1;
+}
+
+// take an object from the pool of the shard, the heap is only used until the
+// pool has warmed up or for objects larger than the largest size class
+static void *pool_get(struct sertee_shard *shard, size_t size) {
+	struct pool_obj *obj;
+	void *ptr;
+	int c;
+	
+	c = pool_class(size);
+	if (c >= 0 && shard->pool[c]) {
+		obj = shard->pool[c];
+		shard->pool[c] = obj->next;
+		shard->pool_len[c] -= 1;
+		
+		COUNTER_ADD(shard->stats.recycled, 1);
+		COUNTER_ADD(shard->stats.cached, -1);
+		
+		return obj;
+	}
+	
+	if (posix_memalign(&ptr, CACHE_LINE_SIZE, c >= 0 ? (size_t) CACHE_LINE_SIZE << c : size))
+		return 0;
+	COUNTER_ADD(shard->stats.allocations, 1);
+	
+	return ptr;
+}
+
+static void *pool_zget(struct sertee_shard *shard, size_t size) {
+	void *ptr;
+	
+	ptr = pool_get(shard, size);
+	if (ptr)
+		memset(ptr, 0, size);
+	
+	return ptr;
+}
+
+// return an object to the pool of the shard that runs the current thread
+static void pool_put(struct sertee_shard *shard, void *ptr, size_t size) {
+	struct pool_obj *obj = (struct pool_obj *) ptr;
+	int c;
+	
+	c = pool_class(size);
+	if (c < 0 || shard->pool_len[c] >= shard->sertee->pool_cache) {
+		free(ptr);
+		COUNTER_ADD(shard->stats.frees, 1);
+		return;
+	}
+	
+	obj->next = shard->pool[c];
+	shard->pool[c] = obj;
+	shard->pool_len[c] += 1;
+	
+	COUNTER_ADD(shard->stats.cached, 1);
+}
+
+// send a command to a shard. If its pipe is full, wait for space only if
+// wait is set, otherwise fail with EAGAIN.
+static int shard_send_cmd(struct sertee_shard *shard, void (*fn)(struct sertee_shard *shard, void *arg), void *arg, int wait) {
+	struct sertee_cmd cmd;
+	struct pollfd pfd;
+	
+	cmd.fn = fn;
+	cmd.arg = arg;
+	
+	// writes up to PIPE_BUF are atomic, so every thread may send commands
+	while (write(shard->cmd_fds[1], &cmd, sizeof(cmd)) != sizeof(cmd)) {
+		if (errno == EINTR)
+			continue;
+		if (errno == EAGAIN && !wait)
+			return -1;
+		if (errno != EAGAIN) {
+			fprintf(stderr, "sending command to shard %u failed: %s\n", shard->id, strerror(errno));
+			return -1;
+		}
+		
+		pfd.fd = shard->cmd_fds[1];
+		pfd.events = POLLOUT;
+		poll(&pfd, 1, -1);
+	}
+	
+	return 0;
+}
+
+// waits while the pipe is full, hence shards must not use it to send commands
+// to other shards
+static int sertee_shard_call(struct sertee_shard *shard, void (*fn)(struct sertee_shard *shard, void *arg), void *arg) {
+	return shard_send_cmd(shard, fn, arg, 1);
+}
+
+// for commands that may be dropped, e.g. if a shard sends them to a shard that
+// may wait for it at the same time
+static int sertee_shard_try_call(struct sertee_shard *shard, void (*fn)(struct sertee_shard *shard, void *arg), void *arg) {
+	return shard_send_cmd(shard, fn, arg, 0);
+}
+
+static size_t arena_round(size_t size) {
+	return (size + ARENA_CHUNK_SIZE - 1) / ARENA_CHUNK_SIZE * ARENA_CHUNK_SIZE;
+}
+
+// first fit of size bytes, size must be a multiple of ARENA_CHUNK_SIZE
+static char *arena_alloc(struct sertee_arena *arena, size_t size) {
+	size_t i, j, n, run;
+	
+	n = size / ARENA_CHUNK_SIZE;
+	
+	pthread_mutex_lock(&arena->lock);
+	run = 0;
+	for (i=0; i < arena->n_chunks; i++) {
+		if (arena->used_map[i / 64] & (1ULL << (i % 64))) {
+			run = 0;
+			continue;
+		}
+		
+		run += 1;
+		if (run < n)
+			continue;
+		
+		for (j=i + 1 - n; j <= i; j++)
+			arena->used_map[j / 64] |= 1ULL << (j % 64);
+		__atomic_store_n(&arena->used, arena->used + size, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&arena->lock);
+		
+		return arena->mem + (i + 1 - n) * ARENA_CHUNK_SIZE;
+	}
+	pthread_mutex_unlock(&arena->lock);
+	
+	return 0;
+}
+
+static void arena_free(struct sertee_arena *arena, char *ptr, size_t size) {
+	size_t i, first;
+	
+	// give the pages back before another thread may take the chunks
+	madvise(ptr, size, MADV_DONTNEED);
+	
+	first = (ptr - arena->mem) / ARENA_CHUNK_SIZE;
+	
+	pthread_mutex_lock(&arena->lock);
+	for (i=first; i < first + size / ARENA_CHUNK_SIZE; i++)
+		arena->used_map[i / 64] &= ~(1ULL << (i % 64));
+	__atomic_store_n(&arena->used, arena->used - size, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&arena->lock);
+}
+
+// find or create the client of the process that sent req
+static struct sertee_client *client_get(struct sertee_source *source, fuse_req_t req) {
+	const struct fuse_ctx *ctx = fuse_req_ctx(req);
+	struct sertee_client *client;
+	
+	for (client = source->clients; client; client = client->next) {
+		if (client->pid == ctx->pid)
+			return client;
+	}
+	
+	client = (struct sertee_client *) pool_zget(source->shard, sizeof(struct sertee_client));
+	if (!client)
+		return 0;
+	client->source = source;
+	client->pid = ctx->pid;
+	client->uid = ctx->uid;
+	
+	pthread_mutex_lock(&source->clients_lock);
+	client->next = source->clients;
+	if (client->next)
+		client->next->prev = client;
+	source->clients = client;
+	pthread_mutex_unlock(&source->clients_lock);
+	
+	return client;
+}
+
+// free the client once it has neither open files nor throttled writes
+static void client_put(struct sertee_client *client) {
+	struct sertee_source *source = client->source;
+	
+	if (client->n_handles || client->throttled_head)
+		return;
+	
+	pthread_mutex_lock(&source->clients_lock);
+	if (client->prev)
+		client->prev->next = client->next;
+	else
+		source->clients = client->next;
+	if (client->next)
+		client->next->prev = client->prev;
+	pthread_mutex_unlock(&source->clients_lock);
+	
+	pool_put(source->shard, client, sizeof(struct sertee_client));
+}
+
+static void sertee_open(fuse_req_t req, struct fuse_file_info *fi) {
+	struct sertee_dev *sertee_dev = (struct sertee_dev *) fuse_req_userdata(req);
+	struct sertee_handle *handle;
+	struct sertee_ring *ring;
+	uint64_t oldest;
+	
+	handle = (struct sertee_handle *) pool_zget(sertee_dev->source->shard, sizeof(struct sertee_handle));
+	if (!handle) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	handle->client = client_get(sertee_dev->source, req);
+	if (!handle->client) {
+		pool_put(sertee_dev->source->shard, handle, sizeof(struct sertee_handle));
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	COUNTER_ADD(handle->client->n_handles, 1);
+	handle->dev = sertee_dev;
+	handle->vmin = sertee_dev->source->vmin;
+	handle->vtime = sertee_dev->source->vtime;
+	handle->stats.pid = fuse_req_ctx(req)->pid;
+	fi->fh = (uintptr_t) handle;
+	
+	pthread_mutex_lock(&sertee_dev->handles_lock);
+	handle->next = sertee_dev->handles;
+	if (handle->next)
+		handle->next->prev = handle;
+	sertee_dev->handles = handle;
+	pthread_mutex_unlock(&sertee_dev->handles_lock);
+	
+	TRACE(open, sertee_dev->dev_name, handle->stats.pid);
+	EVENT(sertee_dev->source->shard, EV_OPEN, sertee_dev->id, handle->stats.pid, 0, 0);
+	
+	ring = &sertee_dev->source->ring;
+	sertee_cursor_open(ring, &handle->cursor);
+	// if buffer contains only valid data, allow client to read the old data.
+	// After the ring grew, only the part that was copied is valid.
+	oldest = sertee_ring_oldest(ring);
+	sertee_cursor_seek(&handle->cursor, ring->head >= ring->size || oldest > 0 ? oldest : ring->head);
+	sertee_dev->n_clients += 1;
+	
+	fuse_reply_open(req, fi);
+}
+
+// number of bytes between the position of the open file and the source
+static size_t get_lag(struct sertee_handle *handle) {
+	return sertee_cursor_lag(&handle->cursor);
+}
+
+// called by the ring if the source overtook an open file, the cursor already
+// moved to the oldest data
+static void dev_overrun(struct sertee_cursor *cursor, uint64_t lost) {
+	struct sertee_dev *sertee_dev = container_of(cursor, struct sertee_handle, cursor)->dev;
+	
+	COUNTER_ADD(sertee_dev->stats.lost, lost);
+	COUNTER_ADD(sertee_dev->stats.overruns, 1);
+	TRACE(overrun, sertee_dev->dev_name, lost);
+	EVENT(sertee_dev->source->shard, EV_OVERRUN, sertee_dev->id, lost, 0, 0);
+}
+
+// largest lag of the open files of a device
+static size_t dev_lag(struct sertee_dev *sertee_dev) {
+	struct sertee_handle *handle;
+	size_t lag, lag_max;
+	
+	lag_max = 0;
+	for (handle = sertee_dev->handles; handle; handle = handle->next) {
+		lag = get_lag(handle);
+		if (lag > lag_max)
+			lag_max = lag;
+	}
+	
+	return lag_max;
+}
+
+static int handle_readable(struct sertee_handle *handle) {
+	return get_lag(handle) >= (handle->dev->lowat ? handle->dev->lowat : 1);
+}
+
+// returns the oldest absolute offset that is still buffered and whose
+// arrival time is still known
+static uint64_t ts_oldest(struct sertee_source *source) {
+	uint64_t oldest;
+	
+	oldest = sertee_ring_oldest(&source->ring);
+	
+	if (source->chunk_head > source->n_chunks) {
+		if (source->chunks[source->chunk_head % source->n_chunks].off > oldest)
+			oldest = source->chunks[source->chunk_head % source->n_chunks].off;
+	}
+	
+	return oldest;
+}
+
+// find the chunk that contains the absolute offset off and its end
+static struct ts_chunk *ts_find_chunk(struct sertee_source *source, uint64_t off, uint64_t *end) {
+	uint64_t lo, hi, mid;
+	
+	lo = source->chunk_head > source->n_chunks ? source->chunk_head - source->n_chunks : 0;
+	hi = source->chunk_head;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (source->chunks[mid % source->n_chunks].off <= off)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	
+	if (lo + 1 < source->chunk_head)
+		*end = source->chunks[(lo + 1) % source->n_chunks].off;
+	else
+		*end = source->ring.head;
+	
+	return &source->chunks[lo % source->n_chunks];
+}
+
+static uint64_t sertee_now(void) {
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_REALTIME, &ts);
+	
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned int hist_index(uint64_t value) {
+	unsigned int bits;
+	
+	if (value < (1 << HIST_SUB_BITS))
+		return value;
+	if (value >= (1ULL << HIST_MAX_BITS))
+		value = (1ULL << HIST_MAX_BITS) - 1;
+	
+	bits = 63 - __builtin_clzll(value);
+	
+	return (bits - HIST_SUB_BITS + 1) * (1 << HIST_SUB_BITS) + ((value >> (bits - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+// the largest value that is counted in bucket idx
+static uint64_t hist_bucket_max(unsigned int idx) {
+	unsigned int bits, sub;
+	
+	if (idx < (1 << HIST_SUB_BITS))
+		return idx;
+	
+	bits = idx / (1 << HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+	sub = idx % (1 << HIST_SUB_BITS);
+	
+	return ((((uint64_t) (1 << HIST_SUB_BITS) + sub + 1)) << (bits - HIST_SUB_BITS)) - 1;
+}
+
+// only called by the thread owning the histogram
+static void hist_record(struct sertee_hist *hist, uint64_t value) {
+	COUNTER_ADD(hist->buckets[hist_index(value)], 1);
+	COUNTER_ADD(hist->count, 1);
+	COUNTER_ADD(hist->sum, value);
+	COUNTER_MAX(hist->max, value);
+}
+
+// the value below which the fraction q of the samples lies, calculated from
+// a relaxed snapshot of the buckets
+static uint64_t hist_percentile(struct sertee_hist *hist, double q) {
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t total, rank, seen;
+	unsigned int i;
+	
+	total = 0;
+	for (i=0; i < HIST_BUCKETS; i++) {
+		counts[i] = COUNTER_GET(hist->buckets[i]);
+		total += counts[i];
+	}
+	if (total == 0)
+		return 0;
+	
+	rank = (uint64_t) (q * total + 0.5);
+	if (rank == 0)
+		rank = 1;
+	
+	seen = 0;
+	for (i=0; i < HIST_BUCKETS; i++) {
+		seen += counts[i];
+		if (seen >= rank)
+			break;
+	}
+	
+	// the bucket bound may be larger than anything we actually saw
+	if (hist_bucket_max(i) > COUNTER_GET(hist->max))
+		return COUNTER_GET(hist->max);
+	
+	return hist_bucket_max(i);
+}
+
+// record how long the oldest unread byte of the open file has been waiting
+static void dev_record_latency(struct sertee_handle *handle, struct sertee_hist *hist, size_t lag) {
+	struct ts_chunk *chunk;
+	uint64_t end, now;
+	
+	if (lag == 0)
+		return;
+	
+	chunk = ts_find_chunk(handle->dev->source, handle->cursor.offset, &end);
+	now = sertee_now();
+	
+	// chunks have realtime timestamps which may jump backwards
+	hist_record(hist, now > chunk->ts ? now - chunk->ts : 0);
+}
+
+static uint64_t sertee_mono(void) {
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// generic cell rate algorithm: a request that uses cost nanoseconds of the
+// rate conforms if the theoretical arrival time tat is at most RATE_BURST_NS
+// ahead of now. Returns 0 and accounts for the request if it conforms,
+// otherwise the time until it will.
+static uint64_t client_rate_wait(uint64_t *tat, uint64_t cost) {
+	uint64_t now;
+	
+	now = sertee_mono();
+	if (*tat < now)
+		*tat = now;
+	if (*tat - now > RATE_BURST_NS)
+		return *tat - now - RATE_BURST_NS;
+	
+	*tat += cost;
+	
+	return 0;
+}
+
+// arm the timerfd of the source for the first timer
+static void source_arm_timers(struct sertee_source *source) {
+	struct itimerspec its;
+	
+	memset(&its, 0, sizeof(its));
+	if (source->timers) {
+		its.it_value.tv_sec = source->timers->deadline / 1000000000;
+		its.it_value.tv_nsec = source->timers->deadline % 1000000000;
+		
+		// a zero value would disarm the timer
+		if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+			its.it_value.tv_nsec = 1;
+	}
+	
+	if (timerfd_settime(source->timer_fd, TFD_TIMER_ABSTIME, &its, 0))
+		fprintf(stderr, "timerfd_settime failed: %s\n", strerror(errno));
+}
+
+static void sertee_timer_del(struct sertee_source *source, struct sertee_timer *timer) {
+	struct sertee_timer **it;
+	
+	if (!timer->armed)
+		return;
+	
+	for (it = &source->timers; *it; it = &(*it)->next) {
+		if (*it == timer) {
+			*it = timer->next;
+			break;
+		}
+	}
+	timer->armed = 0;
+	
+	if (it == &source->timers)
+		source_arm_timers(source);
+}
+
+// (re)start a timer that fires timeout nanoseconds from now
+static void sertee_timer_add(struct sertee_source *source, struct sertee_timer *timer, uint64_t timeout) {
+	struct sertee_timer **it;
+	
+	sertee_timer_del(source, timer);
+	
+	timer->deadline = sertee_mono() + timeout;
+	
+	for (it = &source->timers; *it; it = &(*it)->next) {
+		if ((*it)->deadline > timer->deadline)
+			break;
+	}
+	timer->next = *it;
+	*it = timer;
+	timer->armed = 1;
+	
+	if (it == &source->timers)
+		source_arm_timers(source);
+}
+
+static void source_run_timers(struct sertee_source *source) {
+	struct sertee_timer *timer;
+	uint64_t expirations, now;
+	
+	if (read(source->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+		fprintf(stderr, "read(timerfd) failed: %s\n", strerror(errno));
+	
+	now = sertee_mono();
+	while (source->timers && source->timers->deadline <= now) {
+		timer = source->timers;
+		source->timers = timer->next;
+		timer->armed = 0;
+		
+		timer->fn(timer);
+	}
+	
+	source_arm_timers(source);
+}
+
+static void dev_reply_read(struct sertee_handle *handle, fuse_req_t req, size_t size, off_t off) {
+	struct sertee_dev *sertee_dev = handle->dev;
+	size_t available, lag;
+	const char *data;
+	
+	// the lag only grows until the next read, so we see its maximum here
+	lag = get_lag(handle);
+	COUNTER_MAX(sertee_dev->stats.lag_max, lag);
+	COUNTER_MAX(handle->stats.lag_max, lag);
+	COUNTER_MAX(handle->client->stats.lag_max, lag);
+	
+	if (size)
+		dev_record_latency(handle, &sertee_dev->read_latency, lag);
+	
+	data = sertee_cursor_peek(&handle->cursor, &available);
+	if (off > available) {
+		size = 0;
+	} else {
+		if (off + size > available)
+			size = available - off;
+	}
+	
+	TRACE(read, sertee_dev->dev_name, size, lag, handle->cursor.offset);
+	EVENT(sertee_dev->source->shard, EV_READ, sertee_dev->id, size, lag, handle->cursor.offset);
+	
+	fuse_reply_buf(req, data + off, size);
+	
+	COUNTER_ADD(sertee_dev->stats.reads, 1);
+	COUNTER_ADD(sertee_dev->stats.bytes_read, size);
+	COUNTER_ADD(handle->stats.reads, 1);
+	COUNTER_ADD(handle->stats.bytes_read, size);
+	COUNTER_ADD(handle->client->stats.reads, 1);
+	COUNTER_ADD(handle->client->stats.bytes_read, size);
+	
+	sertee_cursor_consume(&handle->cursor, size);
+	
+	__atomic_store_n(&sertee_dev->stats.lag, dev_lag(sertee_dev), __ATOMIC_RELAXED);
+}
+
+static void handle_unpark(struct sertee_handle *handle) {
+	struct sertee_handle **it;
+	
+	for (it = &handle->dev->parked; *it; it = &(*it)->next_parked) {
+		if (*it == handle) {
+			*it = handle->next_parked;
+			break;
+		}
+	}
+	
+	sertee_timer_del(handle->dev->source, &handle->timer);
+	handle->req = 0;
+}
+
+// answer the parked read request if the VMIN/VTIME conditions are met
+static void handle_check_read(struct sertee_handle *handle, int timeout) {
+	fuse_req_t req;
+	size_t lag, want;
+	
+	lag = get_lag(handle);
+	want = handle->vmin < handle->req_size ? handle->vmin : handle->req_size;
+	
+	if (timeout || (handle->vmin && lag >= want) || (!handle->vmin && lag > 0)) {
+		req = handle->req;
+		
+		handle_unpark(handle);
+		dev_reply_read(handle, req, handle->req_size, 0);
+		return;
+	}
+	
+	// with VMIN and VTIME, VTIME is an inter-byte timer that starts with the
+	// first byte
+	if (handle->vmin && handle->vtime && lag > handle->req_lag)
+		sertee_timer_add(handle->dev->source, &handle->timer, handle->vtime * 100000000ULL);
+	handle->req_lag = lag;
+}
+
+static void handle_timeout(struct sertee_timer *timer) {
+	struct sertee_handle *handle = container_of(timer, struct sertee_handle, timer);
+	
+	handle_check_read(handle, 1);
+}
+
+static void handle_interrupt(fuse_req_t req, void *data) {
+	struct sertee_handle *handle = (struct sertee_handle *) data;
+	
+	if (handle->req != req)
+		return;
+	
+	handle_unpark(handle);
+	fuse_reply_err(req, EINTR);
+}
+
+// check the parked reads of a device after new data arrived
+static void dev_wake_parked(struct sertee_dev *sertee_dev) {
+	struct sertee_handle *handle, *next;
+	
+	for (handle = sertee_dev->parked; handle; handle = next) {
+		next = handle->next_parked;
+		
+		handle_check_read(handle, 0);
+	}
+}
+
+static void sertee_release(fuse_req_t req, struct fuse_file_info *fi) {
+	struct sertee_dev *sertee_dev = (struct sertee_dev *) fuse_req_userdata(req);
+	struct sertee_handle *handle;
+	fuse_req_t req_parked;
+	
+	handle = (struct sertee_handle *) (uintptr_t) fi->fh;
+	TRACE(release, sertee_dev->dev_name, handle->stats.pid);
+	EVENT(sertee_dev->source->shard, EV_RELEASE, sertee_dev->id, handle->stats.pid, 0, 0);
+	if (handle->req) {
+		req_parked = handle->req;
+		
+		handle_unpark(handle);
+		fuse_reply_err(req_parked, EBADF);
+	}
+	
+	pthread_mutex_lock(&sertee_dev->handles_lock);
+	if (handle->prev)
+		handle->prev->next = handle->next;
+	else
+		sertee_dev->handles = handle->next;
+	if (handle->next)
+		handle->next->prev = handle->prev;
+	pthread_mutex_unlock(&sertee_dev->handles_lock);
+	
+	if (handle->poll_handle)
+		fuse_pollhandle_destroy(handle->poll_handle);
+	sertee_cursor_close(&handle->cursor);
+	
+	COUNTER_ADD(handle->client->n_handles, -1);
+	client_put(handle->client);
+	
+	pool_put(sertee_dev->source->shard, handle, sizeof(struct sertee_handle));
+	
+	sertee_dev->n_clients -= 1;
+	__atomic_store_n(&sertee_dev->stats.lag, dev_lag(sertee_dev), __ATOMIC_RELAXED);
+	
+	// workaround to call send_ok() as client would hang without it
+	fuse_reply_buf(req, 0, 0);
+}
+
+static void handle_read(struct sertee_handle *handle, fuse_req_t req, size_t size, off_t off, int nonblock) {
+	struct sertee_dev *sertee_dev = handle->dev;
+	
+	// without VMIN and VTIME we return what we have, like before
+	if (nonblock || (handle->vmin == 0 && handle->vtime == 0) || handle->req || size == 0) {
+		dev_reply_read(handle, req, size, off);
+		return;
+	}
+	
+	COUNTER_ADD(sertee_dev->stats.parked, 1);
+	TRACE(read_park, sertee_dev->dev_name, size, handle->vmin, handle->vtime);
+	EVENT(sertee_dev->source->shard, EV_READ_PARK, sertee_dev->id, size, handle->vmin, handle->vtime);
+	
+	handle->req = req;
+	handle->req_size = size;
+	handle->req_lag = 0;
+	handle->timer.fn = handle_timeout;
+	
+	handle->next_parked = sertee_dev->parked;
+	sertee_dev->parked = handle;
+	
+	// a pure VTIME read times out if no data arrives at all
+	if (handle->vmin == 0)
+		sertee_timer_add(sertee_dev->source, &handle->timer, handle->vtime * 100000000ULL);
+	
+	handle_check_read(handle, 0);
+	
+	// the interrupt function is called immediately if the request was
+	// already interrupted
+	if (handle->req == req)
+		fuse_req_interrupt_func(req, handle_interrupt, handle);
+}
+
+// the rate limit of a throttled read expired, continue like a new read
+static void handle_throttle_timeout(struct sertee_timer *timer) {
+	struct sertee_handle *handle = container_of(timer, struct sertee_handle, timer);
+	fuse_req_t req;
+	
+	req = handle->req;
+	handle->req = 0;
+	
+	handle_read(handle, req, handle->req_size, 0, 0);
+}
+
+static void sertee_read(fuse_req_t req, size_t size, off_t off,
+						 struct fuse_file_info *fi)
+{
+	struct sertee_dev *sertee_dev = (struct sertee_dev *) fuse_req_userdata(req);
+	struct sertee_handle *handle = (struct sertee_handle *) (uintptr_t) fi->fh;
+	uint64_t cost, wait;
+	
+	// a read request that exceeds the rate limit of the client fails if it
+	// does not block and waits otherwise. The flags of a read request
+	// reflect later fcntl(F_SETFL) calls, too.
+	if (sertee_dev->source->client_read_rate && !handle->req) {
+		cost = 1000000000ULL / sertee_dev->source->client_read_rate;
+		wait = client_rate_wait(&handle->client->read_tat, cost);
+		if (wait) {
+			COUNTER_ADD(handle->client->stats.throttled_reads, 1);
+			EVENT(sertee_dev->source->shard, EV_THROTTLE_READ, sertee_dev->id, handle->client->pid, wait, size);
+			
+			if (fi->flags & O_NONBLOCK) {
+				fuse_reply_err(req, EAGAIN);
+				return;
+			}
+			
+			// the delayed request counts as well
+			handle->client->read_tat += cost;
+			
+			handle->req = req;
+			handle->req_size = size;
+			handle->timer.fn = handle_throttle_timeout;
+			sertee_timer_add(sertee_dev->source, &handle->timer, wait);
+			
+			fuse_req_interrupt_func(req, handle_interrupt, handle);
+			return;
+		}
+	}
+	
+	handle_read(handle, req, size, off, fi->flags & O_NONBLOCK);
+}
+
+#define MONITOR_ALIGN(x) (((x) + 7) & ~((size_t) 7))
+
+// returns the offset of the record at pos, skipping the padding at the end
+static uint64_t monitor_skip_pad(struct sertee_monitor *monitor, uint64_t pos) {
+	size_t rem;
+	struct monitor_rec *rec;
+	
+	if (pos >= monitor->head)
+		return pos;
+	
+	rem = monitor->size - pos % monitor->size;
+	if (rem < sizeof(struct monitor_rec))
+		return pos + rem;
+	
+	rec = (struct monitor_rec *) (monitor->buf + pos % monitor->size);
+	if (rec->dir == MONITOR_PAD)
+		return pos + rem;
+	
+	return pos;
+}
+
+static void monitor_drop_oldest(struct sertee_monitor *monitor) {
+	struct monitor_rec *rec;
+	
+	monitor->tail = monitor_skip_pad(monitor, monitor->tail);
+	if (monitor->tail >= monitor->head)
+		return;
+	
+	rec = (struct monitor_rec *) (monitor->buf + monitor->tail % monitor->size);
+	monitor->tail += MONITOR_ALIGN(sizeof(struct monitor_rec) + rec->len);
+}
+
+static void monitor_record(struct sertee_source *source, enum monitor_dir dir,
+						   const char *origin, uint32_t pid, const char *data, size_t len,
+						   uint64_t ts)
+{
+	struct sertee_monitor *monitor = source->monitor;
+	struct monitor_reader *reader;
+	struct monitor_rec *rec;
+	size_t need, rem, max_len;
+	
+	if (!monitor)
+		return;
+	
+	// a record may only use half of the ring
+	max_len = monitor->size / 2 - sizeof(struct monitor_rec);
+	if (max_len > UINT16_MAX)
+		max_len = UINT16_MAX;
+	
+	while (len > 0) {
+		rec = 0;
+		need = MONITOR_ALIGN(sizeof(struct monitor_rec) + (len < max_len ? len : max_len));
+		
+		// records are never split, so pad the end of the ring if necessary
+		rem = monitor->size - monitor->head % monitor->size;
+		if (rem < need) {
+			while (monitor->head + rem - monitor->tail > monitor->size)
+				monitor_drop_oldest(monitor);
+			
+			if (rem >= sizeof(struct monitor_rec)) {
+				rec = (struct monitor_rec *) (monitor->buf + monitor->head % monitor->size);
+				rec->dir = MONITOR_PAD;
+			}
+			monitor->head += rem;
+		}
+		
+		while (monitor->head + need - monitor->tail > monitor->size)
+			monitor_drop_oldest(monitor);
+		
+		rec = (struct monitor_rec *) (monitor->buf + monitor->head % monitor->size);
+		rec->ts = ts;
+		rec->origin = origin;
+		rec->pid = pid;
+		rec->len = len < max_len ? len : max_len;
+		rec->dir = dir;
+		memcpy(rec + 1, data, rec->len);
+		
+		monitor->head += need;
+		data += rec->len;
+		len -= rec->len;
+	}
+	
+	for (reader = monitor->readers; reader; reader = reader->next) {
+		if (reader->poll_handle) {
+			fuse_notify_poll(reader->poll_handle);
+			fuse_pollhandle_destroy(reader->poll_handle);
+			reader->poll_handle = 0;
+		}
+	}
+}
+
+#define PCAPNG_ALIGN(x) (((x) + 3) & ~((size_t) 3))
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_EPB_INBOUND 1
+#define PCAPNG_EPB_OUTBOUND 2
+// there is no link type for raw serial data, hence we use the first
+// user-defined one
+#define PCAPNG_LINKTYPE_USER0 147
+
+static size_t pcapng_put_opt(char *buf, uint16_t code, const void *data, size_t len) {
+	uint16_t hdr[2];
+	
+	hdr[0] = code;
+	hdr[1] = len;
+	memcpy(buf, hdr, sizeof(hdr));
+	if (len)
+		memcpy(buf + sizeof(hdr), data, len);
+	memset(buf + sizeof(hdr) + len, 0, PCAPNG_ALIGN(len) - len);
+	
+	return sizeof(hdr) + PCAPNG_ALIGN(len);
+}
+
+// write a block with the given body and fill in the length fields
+static size_t pcapng_finish_block(char *buf, uint32_t type, size_t body_len) {
+	uint32_t hdr[2];
+	
+	hdr[0] = type;
+	hdr[1] = 8 + body_len + 4;
+	memcpy(buf, hdr, sizeof(hdr));
+	memcpy(buf + 8 + body_len, &hdr[1], 4);
+	
+	return hdr[1];
+}
+
+static void capture_flush(struct sertee_shard *shard) {
+	struct capture_batch *batch = shard->capture_batch;
+	
+	if (!batch || batch->len == 0)
+		return;
+	
+	// the capture thread returns the batch once it is written. If it cannot
+	// keep up, the records are dropped instead of blocking the event loop.
+	if (write(shard->sertee->capture_fds[1], &batch, sizeof(batch)) != sizeof(batch)) {
+		if (errno != EAGAIN)
+			fprintf(stderr, "passing capture batch failed: %s\n", strerror(errno));
+		COUNTER_ADD(shard->stats.capture_drops, batch->n_records);
+		batch->len = 0;
+		batch->n_records = 0;
+		return;
+	}
+	
+	shard->capture_batch = 0;
+}
+
+// returns one of the CAPTURE_BATCHES batches of the shard or 0 if all of them
+// are waiting for the capture thread
+static struct capture_batch *capture_get_batch(struct sertee_shard *shard) {
+	struct capture_batch *batch;
+	
+	if (shard->capture_batch)
+		return shard->capture_batch;
+	
+	if (read(shard->capture_free_fds[0], &batch, sizeof(batch)) != sizeof(batch))
+		return 0;
+	
+	batch->len = 0;
+	batch->n_records = 0;
+	shard->capture_batch = batch;
+	
+	return batch;
+}
+
+// add an enhanced packet block to the batch of the current shard
+static void capture_record(struct sertee_source *source, enum monitor_dir dir,
+						   const char *origin, uint32_t pid, const char *data, size_t len,
+						   uint64_t ts)
+{
+	struct capture_batch *batch;
+	uint32_t epb[5], flags;
+	char comment[128];
+	size_t max_len, cap_len, pos;
+	int comment_len;
+	
+	if (source->sertee->capture_fd < 0)
+		return;
+	
+	comment_len = 0;
+	if (dir == MONITOR_TX) {
+		comment_len = snprintf(comment, sizeof(comment), "%s pid %" PRIu32, origin, pid);
+		if (comment_len >= sizeof(comment))
+			comment_len = sizeof(comment) - 1;
+	}
+	
+	// block header, fixed fields, options and trailing length
+	max_len = 8 + sizeof(epb) + 4 + 8 + 4 + PCAPNG_ALIGN(sizeof(comment)) + 4;
+	
+	batch = capture_get_batch(source->shard);
+	if (batch && batch->len + max_len + PCAPNG_ALIGN(len) > sizeof(batch->data)) {
+		capture_flush(source->shard);
+		batch = capture_get_batch(source->shard);
+	}
+	if (!batch) {
+		COUNTER_ADD(source->shard->stats.capture_drops, 1);
+		return;
+	}
+	
+	// data that does not fit into an empty batch is truncated
+	cap_len = len;
+	if (max_len + PCAPNG_ALIGN(cap_len) > sizeof(batch->data))
+		cap_len = sizeof(batch->data) - max_len - 4;
+	
+	if (batch->len == 0)
+		batch->first_ts = ts;
+	
+	epb[0] = source->id;
+	epb[1] = ts >> 32;
+	epb[2] = ts & 0xffffffff;
+	epb[3] = cap_len;
+	epb[4] = len;
+	
+	pos = batch->len + 8;
+	memcpy(batch->data + pos, epb, sizeof(epb));
+	pos += sizeof(epb);
+	memcpy(batch->data + pos, data, cap_len);
+	memset(batch->data + pos + cap_len, 0, PCAPNG_ALIGN(cap_len) - cap_len);
+	pos += PCAPNG_ALIGN(cap_len);
+	
+	flags = dir == MONITOR_RX ? PCAPNG_EPB_INBOUND : PCAPNG_EPB_OUTBOUND;
+	pos += pcapng_put_opt(batch->data + pos, PCAPNG_OPT_EPB_FLAGS, &flags, sizeof(flags));
+	if (comment_len > 0)
+		pos += pcapng_put_opt(batch->data + pos, PCAPNG_OPT_COMMENT, comment, comment_len);
+	pos += pcapng_put_opt(batch->data + pos, PCAPNG_OPT_END, 0, 0);
+	
+	batch->len += pcapng_finish_block(batch->data + batch->len, PCAPNG_EPB, pos - batch->len - 8);
+	batch->n_records += 1;
+}
+
+// record traffic of a source for the monitor device and the capture file
+static void record_traffic(struct sertee_source *source, enum monitor_dir dir,
+						   const char *origin, uint32_t pid, const char *data, size_t len,
+						   uint64_t ts)
+{
+	if (!source->monitor && source->sertee->capture_fd < 0)
+		return;
+	
+	if (ts == 0)
+		ts = sertee_now();
+	
+	monitor_record(source, dir, origin, pid, data, len, ts);
+	capture_record(source, dir, origin, pid, data, len, ts);
+}
+
+// append one line per source to the status report of a broadcast device
+static void broadcast_report(struct sertee_broadcast *broadcast, struct sertee_write_op *op) {
+	unsigned int i;
+	char line[256];
+	int len;
+	char *nl;
+	
+	for (i=0; i < op->n_tx; i++) {
+		len = snprintf(line, sizeof(line), "%" PRIu64 " %s %zu/%zu %s\n",
+				op->seq, op->tx[i].source->source_name, op->tx[i].done, op->size,
+				op->tx[i].error ? strerror(op->tx[i].error) : "ok");
+		if (len < 0)
+			continue;
+		if (len >= sizeof(line))
+			len = sizeof(line) - 1;
+		
+		// drop the oldest lines if nobody reads the report
+		while (broadcast->report_len + len > sizeof(broadcast->report)) {
+			nl = memchr(broadcast->report, '\n', broadcast->report_len);
+			if (!nl) {
+				broadcast->report_len = 0;
+				break;
+			}
+			
+			broadcast->report_len -= nl + 1 - broadcast->report;
+			memmove(broadcast->report, nl + 1, broadcast->report_len);
+		}
+		
+		memcpy(broadcast->report + broadcast->report_len, line, len);
+		broadcast->report_len += len;
+	}
+	
+	if (broadcast->poll_handle) {
+		fuse_notify_poll(broadcast->poll_handle);
+		fuse_pollhandle_destroy(broadcast->poll_handle);
+		broadcast->poll_handle = 0;
+	}
+}
+
+static size_t write_op_size(unsigned int n_tx, size_t size) {
+	return sizeof(struct sertee_write_op) + n_tx * sizeof(struct sertee_tx) + size;
+}
+
+// ops are freed by the shard of their broadcast device or of their source
+static struct sertee_shard *write_op_shard(struct sertee_write_op *op) {
+	return op->broadcast ? op->broadcast->shard : op->tx[0].source->shard;
+}
+
+static void write_op_finish(struct sertee_write_op *op) {
+	unsigned int i, n_ok;
+	int error;
+	
+	n_ok = 0;
+	error = 0;
+	for (i=0; i < op->n_tx; i++) {
+		if (op->tx[i].error == 0)
+			n_ok += 1;
+		else
+		if (!error)
+			error = op->tx[i].error;
+	}
+	
+	if (op->broadcast)
+		broadcast_report(op->broadcast, op);
+	
+	// partial failures are only visible through the report of a broadcast
+	// device, the client gets an error only if no source accepted the data
+	if (n_ok)
+		fuse_reply_write(op->req, op->size);
+	else
+		fuse_reply_err(op->req, error);
+	
+	pool_put(write_op_shard(op), op, write_op_size(op->n_tx, op->size));
+}
+
+static void shard_finish_write_op(struct sertee_shard *shard, void *arg) {
+	write_op_finish((struct sertee_write_op *) arg);
+}
+
+// hand a finished op back to the shard that owns it. Shards never wait for
+// each other, if the pipe is full the op is sent again by the event loop.
+static void write_op_done(struct sertee_shard *shard, struct sertee_write_op *op) {
+	struct sertee_shard *owner = write_op_shard(op);
+	
+	if (owner == shard) {
+		write_op_finish(op);
+		return;
+	}
+	
+	if (!shard->op_retry_head && sertee_shard_try_call(owner, shard_finish_write_op, op) == 0)
+		return;
+	
+	op->next = 0;
+	if (shard->op_retry_tail)
+		shard->op_retry_tail->next = op;
+	else
+		shard->op_retry_head = op;
+	shard->op_retry_tail = op;
+}
+
+// enable EPOLLOUT for the source only while data is queued
+static void source_watch_tx(struct sertee_source *source) {
+	uint32_t events;
+	
+	events = source->tx_head ? EPOLLIN | EPOLLOUT : EPOLLIN;
+	if (source->source_eevent.events == events || source->source_fd == -1)
+		return;
+	
+	// a migrating source is added with these events by its new shard
+	source->source_eevent.events = events;
+	if (source->detached)
+		return;
+	
+	if (epoll_ctl(source->shard->epoll_fd, EPOLL_CTL_MOD, source->source_fd, &source->source_eevent))
+		fprintf(stderr, "epoll_ctl(source) failed: %s\n", strerror(errno));
+}
+
+// write as much queued data as the source accepts without blocking
+void source_write(struct sertee_source *source) {
+	struct sertee_tx *tx;
+	ssize_t srv;
+	
+	while (source->tx_head) {
+		tx = source->tx_head;
+		
+		// pending writes fail while the source is disconnected
+		if (source->source_fd == -1) {
+			srv = -1;
+			errno = EIO;
+		} else
+		if (source->gen) {
+			// a generator accepts and discards everything
+			srv = tx->op->size - tx->done;
+		} else
+			srv = write(source->source_fd, tx->op->data + tx->done, tx->op->size - tx->done);
+		if (srv < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			
+			tx->error = errno;
+			COUNTER_ADD(source->stats.write_errors, 1);
+		} else {
+			COUNTER_ADD(source->stats.writes, 1);
+			COUNTER_ADD(source->stats.bytes_out, srv);
+			
+			tx->done += srv;
+			if (tx->done < tx->op->size)
+				continue;
+		}
+		
+		EVENT(source->shard, EV_WRITE_DONE, source->id, tx->done, tx->op->size, tx->error);
+		
+		source->tx_head = tx->next;
+		if (!source->tx_head)
+			source->tx_tail = 0;
+		
+		// parts of a broadcast finish on the shards of their sources
+		if (__atomic_sub_fetch(&tx->op->n_pending, 1, __ATOMIC_ACQ_REL) == 0)
+			write_op_done(source->shard, tx->op);
+	}
+	
+	source_watch_tx(source);
+}
+
+// copy the data of a write request, the request fails if this is not possible
+static struct sertee_write_op *write_op_new(fuse_req_t req, const char *buf, size_t size,
+						  struct sertee_source **sources, unsigned int n_sources,
+						  struct sertee_broadcast *broadcast, const char *origin)
+{
+	struct sertee_write_op *op;
+	struct sertee_tx *tx;
+	unsigned int i;
+	
+	op = (struct sertee_write_op *) pool_get(broadcast ? broadcast->shard : sources[0]->shard,
+		write_op_size(n_sources, size));
+	if (!op) {
+		fuse_reply_err(req, ENOMEM);
+		return 0;
+	}
+	
+	op->req = req;
+	op->broadcast = broadcast;
+	op->seq = broadcast ? ++broadcast->seq : 0;
+	op->origin = origin;
+	op->pid = fuse_req_ctx(req)->pid;
+	op->next = 0;
+	op->data = (char *) &op->tx[n_sources];
+	op->size = size;
+	op->n_tx = n_sources;
+	op->n_pending = n_sources;
+	memcpy(op->data, buf, size);
+	
+	for (i=0; i < n_sources; i++) {
+		tx = &op->tx[i];
+		
+		tx->next = 0;
+		tx->op = op;
+		tx->source = sources[i];
+		tx->done = 0;
+		tx->error = 0;
+	}
+	
+	return op;
+}
+
+static void tx_queue(struct sertee_tx *tx) {
+	struct sertee_source *source = tx->source;
+	
+	record_traffic(source, MONITOR_TX, tx->op->origin, tx->op->pid, tx->op->data, tx->op->size, 0);
+	
+	tx->next = 0;
+	if (source->tx_tail)
+		source->tx_tail->next = tx;
+	else
+		source->tx_head = tx;
+	source->tx_tail = tx;
+}
+
+// parts of broadcast writes that the event loop sends to their shard
+static void shard_retry_tx(struct sertee_shard *shard, struct sertee_tx *tx) {
+	tx->next = 0;
+	if (shard->tx_retry_tail)
+		shard->tx_retry_tail->next = tx;
+	else
+		shard->tx_retry_head = tx;
+	shard->tx_retry_tail = tx;
+}
+
+// a part of a broadcast write arrived at the shard of its source
+static void shard_queue_tx(struct sertee_shard *shard, void *arg) {
+	struct sertee_tx *tx = (struct sertee_tx *) arg;
+	struct sertee_source *source = tx->source;
+	
+	// the source moved on while the command was in the pipe
+	if (__atomic_load_n(&source->shard, __ATOMIC_ACQUIRE) != shard) {
+		shard_retry_tx(shard, tx);
+		return;
+	}
+	
+	tx_queue(tx);
+	source_write(source);
+}
+
+// pass a part of a broadcast write to the shard of its source, keeping the
+// order of the parts that wait for a full pipe
+static void shard_forward_tx(struct sertee_shard *shard, struct sertee_tx *tx) {
+	struct sertee_shard *target = __atomic_load_n(&tx->source->shard, __ATOMIC_ACQUIRE);
+	
+	if (!shard->tx_retry_head && sertee_shard_try_call(target, shard_queue_tx, tx) == 0)
+		return;
+	
+	shard_retry_tx(shard, tx);
+}
+
+// send the commands again that did not fit into the pipes of other shards
+static void shard_retry_forward(struct sertee_shard *shard) {
+	struct sertee_tx *tx;
+	struct sertee_write_op *op;
+	
+	while (shard->tx_retry_head) {
+		tx = shard->tx_retry_head;
+		
+		if (sertee_shard_try_call(__atomic_load_n(&tx->source->shard, __ATOMIC_ACQUIRE), shard_queue_tx, tx))
+			break;
+		
+		shard->tx_retry_head = tx->next;
+		if (!shard->tx_retry_head)
+			shard->tx_retry_tail = 0;
+	}
+	
+	while (shard->op_retry_head) {
+		op = shard->op_retry_head;
+		
+		if (sertee_shard_try_call(write_op_shard(op), shard_finish_write_op, op))
+			break;
+		
+		shard->op_retry_head = op->next;
+		if (!shard->op_retry_head)
+			shard->op_retry_tail = 0;
+	}
+}
+
+// queue the data for every source and start writing. The parts for sources
+// of other shards are forwarded to them.
+static void write_op_start(struct sertee_shard *shard, struct sertee_write_op *op) {
+	unsigned int i, n_tx;
+	
+	n_tx = op->n_tx;
+	for (i=0; i < n_tx; i++) {
+		if (op->tx[i].source->shard == shard)
+			tx_queue(&op->tx[i]);
+		else
+			shard_forward_tx(shard, &op->tx[i]);
+	}
+	
+	// the source that finishes the last part frees op, so do not touch op here
+	for (i=0; i < n_tx; i++) {
+		if (op->tx[i].source->shard == shard)
+			source_write(op->tx[i].source);
+	}
+}
+
+static void sertee_submit_write(fuse_req_t req, const char *buf, size_t size,
+						  struct sertee_source **sources, unsigned int n_sources,
+						  struct sertee_broadcast *broadcast, const char *origin)
+{
+	struct sertee_write_op *op;
+	
+	op = write_op_new(req, buf, size, sources, n_sources, broadcast, origin);
+	if (op)
+		write_op_start(broadcast ? broadcast->shard : sources[0]->shard, op);
+}
+
+static uint64_t client_write_cost(struct sertee_client *client, struct sertee_write_op *op) {
+	return op->size * 1000000000ULL / client->source->client_write_rate;
+}
+
+// start the throttled writes of a client as far as its rate limit allows
+static void client_timeout(struct sertee_timer *timer) {
+	struct sertee_client *client = container_of(timer, struct sertee_client, timer);
+	struct sertee_write_op *op;
+	uint64_t wait;
+	
+	while (client->throttled_head) {
+		op = client->throttled_head;
+		
+		wait = client_rate_wait(&client->write_tat, client_write_cost(client, op));
+		if (wait) {
+			sertee_timer_add(client->source, &client->timer, wait);
+			return;
+		}
+		
+		client->throttled_head = op->next;
+		if (!client->throttled_head)
+			client->throttled_tail = 0;
+		
+		write_op_start(client->source->shard, op);
+	}
+	
+	client_put(client);
+}
+
+// returns 1 if the write has to wait for the rate limit of the client. Writes
+// of a client are always started in order.
+static int client_throttle_write(struct sertee_client *client, struct sertee_write_op *op) {
+	uint64_t wait;
+	
+	if (!client->throttled_head) {
+		wait = client_rate_wait(&client->write_tat, client_write_cost(client, op));
+		if (!wait)
+			return 0;
+		
+		client->timer.fn = client_timeout;
+		sertee_timer_add(client->source, &client->timer, wait);
+	}
+	
+	COUNTER_ADD(client->stats.throttled_writes, 1);
+	EVENT(client->source->shard, EV_THROTTLE_WRITE, client->source->id, client->pid, op->size, 0);
+	
+	if (client->throttled_tail)
+		client->throttled_tail->next = op;
+	else
+		client->throttled_head = op;
+	client->throttled_tail = op;
+	
+	return 1;
+}
+
+static void sertee_write(fuse_req_t req, const char *buf, size_t size,
+						  off_t off, struct fuse_file_info *fi)
+{
+	struct sertee_dev *sertee_dev = (struct sertee_dev *) fuse_req_userdata(req);
+	struct sertee_handle *handle = (struct sertee_handle *) (uintptr_t) fi->fh;
+	struct sertee_write_op *op;
+	
+	TRACE(write, sertee_dev->dev_name, size, fuse_req_ctx(req)->pid);
+	EVENT(sertee_dev->source->shard, EV_WRITE, sertee_dev->id, size, fuse_req_ctx(req)->pid, 0);
+	
+	COUNTER_ADD(sertee_dev->stats.writes, 1);
+	COUNTER_ADD(sertee_dev->stats.bytes_written, size);
+	COUNTER_ADD(handle->stats.writes, 1);
+	COUNTER_ADD(handle->stats.bytes_written, size);
+	COUNTER_ADD(handle->client->stats.writes, 1);
+	COUNTER_ADD(handle->client->stats.bytes_written, size);
+	
+	op = write_op_new(req, buf, size, &sertee_dev->source, 1, 0, sertee_dev->dev_name);
+	if (!op)
+		return;
+	
+	if (sertee_dev->source->client_write_rate && client_throttle_write(handle->client, op))
+		return;
+	
+	write_op_start(sertee_dev->source->shard, op);
+}
+
+// with CUSE_UNRESTRICTED_IOCTL the kernel does not know the size of the
+// arguments, hence we have to ask for them with a retry first. Returns 1 if
+// the request was answered with a retry.
+static int ioctl_retry(fuse_req_t req, void *arg, size_t in_size, size_t in_bufsz,
+					   size_t out_size, size_t out_bufsz)
+{
+	struct iovec in_iov, out_iov;
+	
+	if (in_bufsz >= in_size && out_bufsz >= out_size)
+		return 0;
+	
+	in_iov.iov_base = arg;
+	in_iov.iov_len = in_size;
+	out_iov.iov_base = arg;
+	out_iov.iov_len = out_size;
+	
+	fuse_reply_ioctl_retry(req, &in_iov, in_size ? 1 : 0, &out_iov, out_size ? 1 : 0);
+	
+	return 1;
+}
+
+static int source_get_termios(struct sertee_source *source) {
+	if (source->termios_valid)
+		return 0;
+	
+	if (ioctl(source->source_fd, TCGETS, &source->termios))
+		return errno;
+	
+	source->termios_valid = 1;
+	
+	return 0;
+}
+
+// apply new line settings only if they differ from the current ones
+static int source_set_termios(struct sertee_source *source, const struct sertee_ktermios *termios) {
+	int rv;
+	
+	rv = source_get_termios(source);
+	if (rv)
+		return rv;
+	
+	if (!memcmp(&source->termios, termios, sizeof(struct sertee_ktermios)))
+		return 0;
+	
+	if (ioctl(source->source_fd, TCSETS, termios))
+		return errno;
+	
+	// the driver might not support all settings, hence ask again next time
+	source->termios_valid = 0;
+	
+	return 0;
+}
+
+static int source_get_modem(struct sertee_source *source, int *modem) {
+	uint64_t now;
+	
+	now = sertee_now();
+	if (source->modem_ts == 0 || now - source->modem_ts > (uint64_t) source->modem_cache * 1000000) {
+		if (ioctl(source->source_fd, TIOCMGET, &source->modem))
+			return errno;
+		
+		source->modem_ts = now;
+	}
+	
+	*modem = source->modem;
+	
+	return 0;
+}
+
+// TIOCMBIS and TIOCMBIC are passed on unchanged as the cached lines may be
+// stale, the cache is refreshed from the driver afterwards
+static int source_set_modem(struct sertee_source *source, int cmd, int bits) {
+	if (ioctl(source->source_fd, cmd, &bits))
+		return errno;
+	
+	if (ioctl(source->source_fd, TIOCMGET, &source->modem) == 0)
+		source->modem_ts = sertee_now();
+	else
+		source->modem_ts = 0;
+	
+	return 0;
+}
+
+static void sertee_ioctl(fuse_req_t req, int cmd, void *arg,
+						  struct fuse_file_info *fi, unsigned flags,
+						  const void *in_buf, size_t in_bufsz, size_t out_bufsz)
+{
+	struct sertee_dev *sertee_dev = (struct sertee_dev *) fuse_req_userdata(req);
+	struct sertee_source *source = sertee_dev->source;
+	struct sertee_handle *handle = (struct sertee_handle *) (uintptr_t) fi->fh;
+	struct sertee_ktermios termios;
+	struct sertee_tx *tx;
+	int rv, value;
+	
+	if (flags & FUSE_IOCTL_COMPAT) {
+		fuse_reply_err(req, ENOSYS);
+		return;
+	}
+	
+	EVENT(source->shard, EV_IOCTL, sertee_dev->id, (unsigned int) cmd, 0, 0);
+	
+	switch (cmd) {
+		case TCGETS:
+			if (ioctl_retry(req, arg, 0, in_bufsz, sizeof(termios), out_bufsz))
+				return;
+			
+			rv = source_get_termios(source);
+			if (rv) {
+				fuse_reply_err(req, rv);
+				return;
+			}
+			
+			// VMIN and VTIME belong to the open file and not to the source
+			memcpy(&termios, &source->termios, sizeof(termios));
+			termios.c_cc[VMIN] = handle->vmin;
+			termios.c_cc[VTIME] = handle->vtime;
+			
+			fuse_reply_ioctl(req, 0, &termios, sizeof(termios));
+			return;
+		case TCSETS:
+		case TCSETSW:
+		case TCSETSF:
+			if (ioctl_retry(req, arg, sizeof(termios), in_bufsz, 0, out_bufsz))
+				return;
+			
+			// we neither wait for the output to drain as this would block
+			// all other clients nor flush the input that is shared with
+			// other clients
+			memcpy(&termios, in_buf, sizeof(termios));
+			
+			rv = source_get_termios(source);
+			if (rv) {
+				fuse_reply_err(req, rv);
+				return;
+			}
+			
+			handle->vmin = termios.c_cc[VMIN];
+			handle->vtime = termios.c_cc[VTIME];
+			termios.c_cc[VMIN] = source->termios.c_cc[VMIN];
+			termios.c_cc[VTIME] = source->termios.c_cc[VTIME];
+			
+			rv = source_set_termios(source, &termios);
+			if (rv) {
+				fuse_reply_err(req, rv);
+				return;
+			}
+			
+			fuse_reply_ioctl(req, 0, 0, 0);
+			return;
+		case TIOCMGET:
+			if (ioctl_retry(req, arg, 0, in_bufsz, sizeof(int), out_bufsz))
+				return;
+			
+			rv = source_get_modem(source, &value);
+			if (rv) {
+				fuse_reply_err(req, rv);
+				return;
+			}
+			
+			fuse_reply_ioctl(req, 0, &value, sizeof(value));
+			return;
+		case TIOCMSET:
+		case TIOCMBIS:
+		case TIOCMBIC:
+			if (ioctl_retry(req, arg, sizeof(int), in_bufsz, 0, out_bufsz))
+				return;
+			
+			memcpy(&value, in_buf, sizeof(value));
+			rv = source_set_modem(source, cmd, value);
+			if (rv) {
+				fuse_reply_err(req, rv);
+				return;
+			}
+			
+			fuse_reply_ioctl(req, 0, 0, 0);
+			return;
+		case TIOCOUTQ:
+			if (ioctl_retry(req, arg, 0, in_bufsz, sizeof(int), out_bufsz))
+				return;
+			
+			value = 0;
+			for (tx = source->tx_head; tx; tx = tx->next)
+				value += tx->op->size - tx->done;
+			
+			fuse_reply_ioctl(req, 0, &value, sizeof(value));
+			return;
+		case TCFLSH:
+			// the argument is passed by value, only drop the unread data of
+			// this open file and keep the data of the source for other clients
+			if ((long) arg == TCIFLUSH || (long) arg == TCIOFLUSH)
+				sertee_cursor_seek(&handle->cursor, source->ring.head);
+			
+			fuse_reply_ioctl(req, 0, 0, 0);
+			return;
+		case TCSBRK:
+			// tcdrain(), we do not block the event loop
+			if ((long) arg == 0) {
+				fuse_reply_err(req, EOPNOTSUPP);
+				return;
+			}
+			
+			fuse_reply_ioctl(req, 0, 0, 0);
+			return;
+		case FIONREAD:
+			if (ioctl_retry(req, arg, 0, in_bufsz, sizeof(int), out_bufsz))
+				return;
+			
+			value = get_lag(handle);
+			
+			fuse_reply_ioctl(req, 0, &value, sizeof(value));
+			return;
+		case SERTEE_IOC_GET_OFFSETS: {
+			struct sertee_offsets offsets;
+			
+			if (ioctl_retry(req, arg, 0, in_bufsz, sizeof(offsets), out_bufsz))
+				return;
+			
+			offsets.read = handle->cursor.offset;
+			offsets.head = source->ring.head;
+			offsets.oldest = sertee_ring_oldest(&source->ring);
+			
+			fuse_reply_ioctl(req, 0, &offsets, sizeof(offsets));
+			return;
+		}
+		case SERTEE_IOC_GET_LAG: {
+			struct sertee_lag lag;
+			
+			if (ioctl_retry(req, arg, 0, in_bufsz, sizeof(lag), out_bufsz))
+				return;
+			
+			lag.lag = get_lag(handle);
+			lag.lost = sertee_dev->stats.lost;
+			lag.overruns = sertee_dev->stats.overruns;
+			
+			fuse_reply_ioctl(req, 0, &lag, sizeof(lag));
+			return;
+		}
+		case SERTEE_IOC_SET_LOWAT: {
+			uint32_t lowat;
+			
+			if (ioctl_retry(req, arg, sizeof(lowat), in_bufsz, 0, out_bufsz))
+				return;
+			
+			memcpy(&lowat, in_buf, sizeof(lowat));
+			if (lowat > source->ring.size) {
+				fuse_reply_err(req, EINVAL);
+				return;
+			}
+			sertee_dev->lowat = lowat;
+			
+			fuse_reply_ioctl(req, 0, 0, 0);
+			return;
+		}
+		case SERTEE_IOC_SEEK_HEAD:
+			sertee_cursor_seek(&handle->cursor, source->ring.head);
+			
+			fuse_reply_ioctl(req, 0, 0, 0);
+			return;
+		case SERTEE_IOC_SEEK: {
+			uint64_t offset;
+			
+			if (ioctl_retry(req, arg, sizeof(offset), in_bufsz, 0, out_bufsz))
+				return;
+			
+			memcpy(&offset, in_buf, sizeof(offset));
+			sertee_cursor_seek(&handle->cursor, offset);
+			
+			fuse_reply_ioctl(req, 0, 0, 0);
+			return;
+		}
+		case TIOCEXCL:
+		case TIOCNXCL:
+			// sharing the source is the purpose of sertee
+			fuse_reply_ioctl(req, 0, 0, 0);
+			return;
+		default:
+			fuse_reply_err(req, ENOTTY);
+	}
+}
+
+static void sertee_poll(fuse_req_t req, struct fuse_file_info *fi,
+			  struct fuse_pollhandle *ph)
+{
+	unsigned revents = 0;
+	struct sertee_dev *sertee_dev = (struct sertee_dev *) fuse_req_userdata(req);
+	struct sertee_handle *handle = (struct sertee_handle *) (uintptr_t) fi->fh;
+	
+	COUNTER_ADD(sertee_dev->stats.polls, 1);
+	COUNTER_ADD(handle->stats.polls, 1);
+	
+	if (ph) {
+		if (handle->poll_handle)
+			fuse_pollhandle_destroy(handle->poll_handle);
+		
+		handle->poll_handle = ph;
+	}
+	
+	if (handle_readable(handle))
+		revents |= POLLIN;
+	
+	TRACE(poll, sertee_dev->dev_name, get_lag(handle), revents);
+	EVENT(sertee_dev->source->shard, EV_POLL, sertee_dev->id, get_lag(handle), revents, ph != 0);
+	
+	fuse_reply_poll(req, revents);
+}
+
+static const struct cuse_lowlevel_ops sertee_llops = {
+	.open = sertee_open,
+	.release = sertee_release,
+	.read = sertee_read,
+	.write = sertee_write,
+	.poll = sertee_poll,
+	.ioctl = sertee_ioctl,
+};
+
+static void broadcast_open(fuse_req_t req, struct fuse_file_info *fi) {
+	fuse_reply_open(req, fi);
+}
+
+static void broadcast_release(fuse_req_t req, struct fuse_file_info *fi) {
+	// workaround to call send_ok() as client would hang without it
+	fuse_reply_buf(req, 0, 0);
+}
+
+// reading a broadcast device returns the status of finished writes
+static void broadcast_read(fuse_req_t req, size_t size, off_t off,
+						 struct fuse_file_info *fi)
+{
+	struct sertee_broadcast *broadcast = (struct sertee_broadcast *) fuse_req_userdata(req);
+	
+	if (size > broadcast->report_len)
+		size = broadcast->report_len;
+	
+	fuse_reply_buf(req, broadcast->report, size);
+	
+	broadcast->report_len -= size;
+	memmove(broadcast->report, broadcast->report + size, broadcast->report_len);
+}
+
+static void broadcast_write(fuse_req_t req, const char *buf, size_t size,
+						  off_t off, struct fuse_file_info *fi)
+{
+	struct sertee_broadcast *broadcast = (struct sertee_broadcast *) fuse_req_userdata(req);
+	
+	EVENT(broadcast->shard, EV_BROADCAST, broadcast->id, size, fuse_req_ctx(req)->pid, 0);
+	
+	sertee_submit_write(req, buf, size, broadcast->sources, broadcast->n_sources, broadcast, broadcast->dev_name);
+}
+
+static void broadcast_poll(fuse_req_t req, struct fuse_file_info *fi,
+			  struct fuse_pollhandle *ph)
+{
+	struct sertee_broadcast *broadcast = (struct sertee_broadcast *) fuse_req_userdata(req);
+	unsigned revents = POLLOUT;
+	
+	if (ph) {
+		if (broadcast->poll_handle)
+			fuse_pollhandle_destroy(broadcast->poll_handle);
+		
+		broadcast->poll_handle = ph;
+	}
+	
+	if (broadcast->report_len > 0)
+		revents |= POLLIN;
+	
+	fuse_reply_poll(req, revents);
+}
+
+static const struct cuse_lowlevel_ops broadcast_llops = {
+	.open = broadcast_open,
+	.release = broadcast_release,
+	.read = broadcast_read,
+	.write = broadcast_write,
+	.poll = broadcast_poll,
+};
+
+// maximum size of the text line of a single record
+#define MONITOR_LINE_SIZE(monitor) (3 * ((monitor)->size / 2) + 1024)
+
+static void monitor_open(fuse_req_t req, struct fuse_file_info *fi) {
+	struct sertee_monitor *monitor = (struct sertee_monitor *) fuse_req_userdata(req);
+	struct sertee_shard *shard = monitor->source->shard;
+	struct monitor_reader *reader;
+	
+	reader = (struct monitor_reader *) pool_zget(shard, sizeof(struct monitor_reader));
+	if (reader)
+		reader->line = (char *) pool_get(shard, 2 * MONITOR_LINE_SIZE(monitor));
+	if (!reader || !reader->line) {
+		if (reader)
+			pool_put(shard, reader, sizeof(struct monitor_reader));
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	
+	// start with the oldest record we still have
+	reader->pos = monitor->tail;
+	
+	reader->next = monitor->readers;
+	if (reader->next)
+		reader->next->prev = reader;
+	monitor->readers = reader;
+	
+	fi->fh = (uintptr_t) reader;
+	
+	fuse_reply_open(req, fi);
+}
+
+static void monitor_release(fuse_req_t req, struct fuse_file_info *fi) {
+	struct sertee_monitor *monitor = (struct sertee_monitor *) fuse_req_userdata(req);
+	struct monitor_reader *reader = (struct monitor_reader *) (uintptr_t) fi->fh;
+	
+	if (reader->prev)
+		reader->prev->next = reader->next;
+	else
+		monitor->readers = reader->next;
+	if (reader->next)
+		reader->next->prev = reader->prev;
+	
+	if (reader->poll_handle)
+		fuse_pollhandle_destroy(reader->poll_handle);
+	pool_put(monitor->source->shard, reader->line, 2 * MONITOR_LINE_SIZE(monitor));
+	pool_put(monitor->source->shard, reader, sizeof(struct monitor_reader));
+	
+	// workaround to call send_ok() as client would hang without it
+	fuse_reply_buf(req, 0, 0);
+}
+
+// render the next record as a text line:
+// <timestamp> <RX|TX> <origin> <pid> <length> <payload as hex>
+static int monitor_render(struct sertee_monitor *monitor, struct monitor_reader *reader, char *line, size_t size) {
+	struct monitor_rec *rec;
+	unsigned char *data;
+	size_t len, i;
+	
+	static const char hex[] = "0123456789abcdef";
+	
+	if (reader->pos < monitor->tail)
+		reader->pos = monitor->tail;
+	reader->pos = monitor_skip_pad(monitor, reader->pos);
+	if (reader->pos >= monitor->head)
+		return 0;
+	
+	rec = (struct monitor_rec *) (monitor->buf + reader->pos % monitor->size);
+	
+	len = snprintf(line, size, "%" PRIu64 ".%09" PRIu64 " %s %.512s %" PRIu32 " %u",
+			rec->ts / 1000000000, rec->ts % 1000000000,
+			rec->dir == MONITOR_RX ? "RX" : "TX",
+			rec->origin, rec->pid, rec->len);
+	
+	data = (unsigned char *) (rec + 1);
+	for (i=0; i < rec->len; i++) {
+		line[len++] = ' ';
+		line[len++] = hex[data[i] >> 4];
+		line[len++] = hex[data[i] & 0xf];
+	}
+	line[len++] = '\n';
+	
+	reader->pos += MONITOR_ALIGN(sizeof(struct monitor_rec) + rec->len);
+	
+	return len;
+}
+
+static void monitor_read(fuse_req_t req, size_t size, off_t off,
+						 struct fuse_file_info *fi)
+{
+	struct sertee_monitor *monitor = (struct sertee_monitor *) fuse_req_userdata(req);
+	struct monitor_reader *reader = (struct monitor_reader *) (uintptr_t) fi->fh;
+	int len;
+	
+	// render as many records as fit into the request
+	if (reader->line_off == reader->line_len) {
+		reader->line_len = 0;
+		reader->line_off = 0;
+		
+		while (reader->line_len < size) {
+			len = monitor_render(monitor, reader, reader->line + reader->line_len, MONITOR_LINE_SIZE(monitor));
+			if (len == 0)
+				break;
+			
+			reader->line_len += len;
+			
+			// the buffer holds two lines, stop if the next one may not fit
+			if (reader->line_len > MONITOR_LINE_SIZE(monitor))
+				break;
+		}
+	}
+	
+	if (size > reader->line_len - reader->line_off)
+		size = reader->line_len - reader->line_off;
+	
+	fuse_reply_buf(req, reader->line + reader->line_off, size);
+	
+	reader->line_off += size;
+}
+
+static void monitor_poll(fuse_req_t req, struct fuse_file_info *fi,
+			  struct fuse_pollhandle *ph)
+{
+	struct sertee_monitor *monitor = (struct sertee_monitor *) fuse_req_userdata(req);
+	struct monitor_reader *reader = (struct monitor_reader *) (uintptr_t) fi->fh;
+	unsigned revents = 0;
+	
+	if (ph) {
+		if (reader->poll_handle)
+			fuse_pollhandle_destroy(reader->poll_handle);
+		
+		reader->poll_handle = ph;
+	}
+	
+	if (reader->line_off < reader->line_len || monitor_skip_pad(monitor, reader->pos < monitor->tail ? monitor->tail : reader->pos) < monitor->head)
+		revents |= POLLIN;
+	
+	fuse_reply_poll(req, revents);
+}
+
+static const struct cuse_lowlevel_ops monitor_llops = {
+	.open = monitor_open,
+	.release = monitor_release,
+	.read = monitor_read,
+	.poll = monitor_poll,
+};
+
+// maximum payload of a single record, longer chunks are split
+#define TSDEV_MAX_PAYLOAD 4096
+// maximum size of a rendered record (JSON escapes a byte with up to 6 chars)
+#define TSDEV_MAX_RECORD (6 * TSDEV_MAX_PAYLOAD + 256)
+
+// render the data at the position of the reader as a record, either binary
+// (struct sertee_ts_rec followed by the payload) or as a JSON line
+static size_t tsdev_render(struct sertee_tsdev *tsdev, struct tsdev_reader *reader, char *out) {
+	struct sertee_source *source = tsdev->source;
+	struct sertee_ts_rec rec;
+	struct ts_chunk *chunk;
+	unsigned char *data;
+	uint64_t end;
+	size_t len, i;
+	
+	static const char hex[] = "0123456789abcdef";
+	
+	if (reader->pos < ts_oldest(source))
+		reader->pos = ts_oldest(source);
+	if (reader->pos >= source->ring.head)
+		return 0;
+	
+	chunk = ts_find_chunk(source, reader->pos, &end);
+	
+	rec.ts = chunk->ts;
+	rec.offset = reader->pos;
+	rec.len = end - reader->pos < TSDEV_MAX_PAYLOAD ? end - reader->pos : TSDEV_MAX_PAYLOAD;
+	rec.reserved = 0;
+	
+	// a chunk is only split at the end of the buffer after a resize
+	if (rec.len > source->ring.size - reader->pos % source->ring.size)
+		rec.len = source->ring.size - reader->pos % source->ring.size;
+	data = (unsigned char *) source->ring.buf + reader->pos % source->ring.size;
+	
+	reader->pos += rec.len;
+	
+	if (!tsdev->json) {
+		memcpy(out, &rec, sizeof(rec));
+		memcpy(out + sizeof(rec), data, rec.len);
+		
+		return sizeof(rec) + rec.len;
+	}
+	
+	len = sprintf(out, "{\"ts\":%" PRIu64 ",\"offset\":%" PRIu64 ",\"len\":%" PRIu32 ",\"data\":\"",
+			rec.ts, rec.offset, rec.len);
+	for (i=0; i < rec.len; i++) {
+		if (data[i] == '"' || data[i] == '\\') {
+			out[len++] = '\\';
+			out[len++] = data[i];
+		} else
+		if (data[i] < 0x20 || data[i] >= 0x7f) {
+			out[len++] = '\\';
+			out[len++] = 'u';
+			out[len++] = '0';
+			out[len++] = '0';
+			out[len++] = hex[data[i] >> 4];
+			out[len++] = hex[data[i] & 0xf];
+		} else {
+			out[len++] = data[i];
+		}
+	}
+	out[len++] = '"';
+	out[len++] = '}';
+	out[len++] = '\n';
+	
+	return len;
+}
+
+static void tsdev_open(fuse_req_t req, struct fuse_file_info *fi) {
+	struct sertee_tsdev *tsdev = (struct sertee_tsdev *) fuse_req_userdata(req);
+	struct sertee_shard *shard = tsdev->source->shard;
+	struct tsdev_reader *reader;
+	
+	reader = (struct tsdev_reader *) pool_zget(shard, sizeof(struct tsdev_reader));
+	if (reader) {
+		reader->out_size = 2 * TSDEV_MAX_RECORD;
+		reader->out = (char *) pool_get(shard, reader->out_size);
+	}
+	if (!reader || !reader->out) {
+		if (reader)
+			pool_put(shard, reader, sizeof(struct tsdev_reader));
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	
+	reader->pos = ts_oldest(tsdev->source);
+	
+	reader->next = tsdev->readers;
+	if (reader->next)
+		reader->next->prev = reader;
+	tsdev->readers = reader;
+	
+	fi->fh = (uintptr_t) reader;
+	
+	fuse_reply_open(req, fi);
+}
+
+static void tsdev_release(fuse_req_t req, struct fuse_file_info *fi) {
+	struct sertee_tsdev *tsdev = (struct sertee_tsdev *) fuse_req_userdata(req);
+	struct tsdev_reader *reader = (struct tsdev_reader *) (uintptr_t) fi->fh;
+	
+	if (reader->prev)
+		reader->prev->next = reader->next;
+	else
+		tsdev->readers = reader->next;
+	if (reader->next)
+		reader->next->prev = reader->prev;
+	
+	if (reader->poll_handle)
+		fuse_pollhandle_destroy(reader->poll_handle);
+	pool_put(tsdev->source->shard, reader->out, reader->out_size);
+	pool_put(tsdev->source->shard, reader, sizeof(struct tsdev_reader));
+	
+	// workaround to call send_ok() as client would hang without it
+	fuse_reply_buf(req, 0, 0);
+}
+
+static void tsdev_read(fuse_req_t req, size_t size, off_t off,
+						 struct fuse_file_info *fi)
+{
+	struct sertee_tsdev *tsdev = (struct sertee_tsdev *) fuse_req_userdata(req);
+	struct tsdev_reader *reader = (struct tsdev_reader *) (uintptr_t) fi->fh;
+	size_t len;
+	
+	// records are only rendered when requested
+	if (reader->out_off == reader->out_len) {
+		reader->out_len = 0;
+		reader->out_off = 0;
+		
+		while (reader->out_len < size && reader->out_len + TSDEV_MAX_RECORD <= reader->out_size) {
+			len = tsdev_render(tsdev, reader, reader->out + reader->out_len);
+			if (len == 0)
+				break;
+			
+			reader->out_len += len;
+		}
+	}
+	
+	if (size > reader->out_len - reader->out_off)
+		size = reader->out_len - reader->out_off;
+	
+	fuse_reply_buf(req, reader->out + reader->out_off, size);
+	
+	reader->out_off += size;
+}
+
+static void tsdev_poll(fuse_req_t req, struct fuse_file_info *fi,
+			  struct fuse_pollhandle *ph)
+{
+	struct sertee_tsdev *tsdev = (struct sertee_tsdev *) fuse_req_userdata(req);
+	struct tsdev_reader *reader = (struct tsdev_reader *) (uintptr_t) fi->fh;
+	unsigned revents = 0;
+	
+	if (ph) {
+		if (reader->poll_handle)
+			fuse_pollhandle_destroy(reader->poll_handle);
+		
+		reader->poll_handle = ph;
+	}
+	
+	if (reader->out_off < reader->out_len || reader->pos < tsdev->source->ring.head)
+		revents |= POLLIN;
+	
+	fuse_reply_poll(req, revents);
+}
+
+static const struct cuse_lowlevel_ops tsdev_llops = {
+	.open = tsdev_open,
+	.release = tsdev_release,
+	.read = tsdev_read,
+	.poll = tsdev_poll,
+};
+
+static void stats_render_hist(FILE *f, const char *dev_name, const char *kind, struct sertee_hist *hist) {
+	fprintf(f, "latency %s %s count %" PRIu64 " p50 %" PRIu64 " p90 %" PRIu64
+			" p99 %" PRIu64 " p999 %" PRIu64 " max %" PRIu64 "\n",
+		dev_name, kind, COUNTER_GET(hist->count),
+		hist_percentile(hist, 0.5), hist_percentile(hist, 0.9),
+		hist_percentile(hist, 0.99), hist_percentile(hist, 0.999),
+		COUNTER_GET(hist->max));
+}
+
+// write the counters of everything into f. The counters of other shards are
+// only read, hence this is a snapshot and not necessarily consistent.
+static void stats_render(struct sertee *sertee, FILE *f) {
+	struct sertee_source *source;
+	struct sertee_dev *sertee_dev;
+	struct sertee_handle *handle;
+	struct sertee_client *client;
+	struct sertee_shard *shard;
+	uint64_t now, last_rx;
+	unsigned int i, j;
+	
+	for (i=0; i < sertee->n_sources; i++) {
+		source = sertee->sources[i];
+		
+		now = sertee_now();
+		last_rx = COUNTER_GET(source->stats.last_rx);
+		
+		fprintf(f, "source %s reads %" PRIu64 " bytes_in %" PRIu64
+				" writes %" PRIu64 " bytes_out %" PRIu64 " write_errors %" PRIu64
+				" disconnects %" PRIu64 " rate_1s %" PRIu64 " rate_10s %" PRIu64
+				" rate_60s %" PRIu64 " utilization %" PRIu64 " idle_ms %" PRIu64
+				" stalled %" PRIu64 " saturated %" PRIu64 " bufsize %zu grows %" PRIu64
+				" shrinks %" PRIu64 " grow_failures %" PRIu64 "\n",
+			source->source_name,
+			COUNTER_GET(source->stats.reads), COUNTER_GET(source->stats.bytes_in),
+			COUNTER_GET(source->stats.writes), COUNTER_GET(source->stats.bytes_out),
+			COUNTER_GET(source->stats.write_errors), COUNTER_GET(source->stats.disconnects),
+			COUNTER_GET(source->stats.rate_1s), COUNTER_GET(source->stats.rate_10s),
+			COUNTER_GET(source->stats.rate_60s), COUNTER_GET(source->stats.utilization),
+			now > last_rx ? (now - last_rx) / 1000000 : 0,
+			COUNTER_GET(source->stats.stalled), COUNTER_GET(source->stats.saturated),
+			COUNTER_GET(source->ring.size), COUNTER_GET(source->stats.grows),
+			COUNTER_GET(source->stats.shrinks), COUNTER_GET(source->stats.grow_failures));
+		
+		for (j=0; j < source->n_devs; j++) {
+			sertee_dev = source->devs[j];
+			
+			fprintf(f, "dev %s reads %" PRIu64 " bytes_read %" PRIu64
+					" writes %" PRIu64 " bytes_written %" PRIu64
+					" polls %" PRIu64 " notifications %" PRIu64 " parked %" PRIu64
+					" lag_max %" PRIu64 " lost %" PRIu64 " overruns %" PRIu64 "\n",
+				sertee_dev->dev_name,
+				COUNTER_GET(sertee_dev->stats.reads), COUNTER_GET(sertee_dev->stats.bytes_read),
+				COUNTER_GET(sertee_dev->stats.writes), COUNTER_GET(sertee_dev->stats.bytes_written),
+				COUNTER_GET(sertee_dev->stats.polls), COUNTER_GET(sertee_dev->stats.notifications),
+				COUNTER_GET(sertee_dev->stats.parked), COUNTER_GET(sertee_dev->stats.lag_max),
+				COUNTER_GET(sertee_dev->stats.lost), COUNTER_GET(sertee_dev->stats.overruns));
+			
+			stats_render_hist(f, sertee_dev->dev_name, "read", &sertee_dev->read_latency);
+			stats_render_hist(f, sertee_dev->dev_name, "notify", &sertee_dev->notify_latency);
+			
+			pthread_mutex_lock(&sertee_dev->handles_lock);
+			for (handle = sertee_dev->handles; handle; handle = handle->next) {
+				fprintf(f, "handle %s pid %" PRIu32 " reads %" PRIu64 " bytes_read %" PRIu64
+						" writes %" PRIu64 " bytes_written %" PRIu64
+						" polls %" PRIu64 " lag_max %" PRIu64 "\n",
+					sertee_dev->dev_name, handle->stats.pid,
+					COUNTER_GET(handle->stats.reads), COUNTER_GET(handle->stats.bytes_read),
+					COUNTER_GET(handle->stats.writes), COUNTER_GET(handle->stats.bytes_written),
+					COUNTER_GET(handle->stats.polls), COUNTER_GET(handle->stats.lag_max));
+			}
+			pthread_mutex_unlock(&sertee_dev->handles_lock);
+		}
+		
+		pthread_mutex_lock(&source->clients_lock);
+		for (client = source->clients; client; client = client->next) {
+			fprintf(f, "client %s pid %" PRIu32 " uid %" PRIu32 " handles %u reads %" PRIu64
+					" bytes_read %" PRIu64 " writes %" PRIu64 " bytes_written %" PRIu64
+					" lag_max %" PRIu64 " throttled_reads %" PRIu64 " throttled_writes %" PRIu64 "\n",
+				source->source_name, client->pid, client->uid, COUNTER_GET(client->n_handles),
+				COUNTER_GET(client->stats.reads), COUNTER_GET(client->stats.bytes_read),
+				COUNTER_GET(client->stats.writes), COUNTER_GET(client->stats.bytes_written),
+				COUNTER_GET(client->stats.lag_max),
+				COUNTER_GET(client->stats.throttled_reads), COUNTER_GET(client->stats.throttled_writes));
+		}
+		pthread_mutex_unlock(&source->clients_lock);
+	}
+	
+	if (sertee->arena) {
+		fprintf(f, "memory budget %zu used %" PRIu64 "\n",
+			sertee->arena->n_chunks * ARENA_CHUNK_SIZE, COUNTER_GET(sertee->arena->used));
+	}
+	
+	for (i=0; i < sertee->n_shards; i++) {
+		shard = &sertee->shards[i];
+		
+		fprintf(f, "shard %u allocations %" PRIu64 " frees %" PRIu64 " recycled %" PRIu64
+				" cached %" PRIu64 " capture_drops %" PRIu64 "\n",
+			shard->id, COUNTER_GET(shard->stats.allocations), COUNTER_GET(shard->stats.frees),
+			COUNTER_GET(shard->stats.recycled), COUNTER_GET(shard->stats.cached),
+			COUNTER_GET(shard->stats.capture_drops));
+	}
+}
+
+static void stats_open(fuse_req_t req, struct fuse_file_info *fi) {
+	struct sertee_statsdev *statsdev = (struct sertee_statsdev *) fuse_req_userdata(req);
+	struct sertee_shard *shard = &statsdev->sertee->shards[0];
+	struct stats_snapshot *snapshot;
+	FILE *f;
+	
+	snapshot = (struct stats_snapshot *) pool_zget(shard, sizeof(struct stats_snapshot));
+	if (!snapshot) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	
+	// the size of the text is not bounded, so it still comes from the heap
+	f = open_memstream(&snapshot->buf, &snapshot->len);
+	if (!f) {
+		pool_put(shard, snapshot, sizeof(struct stats_snapshot));
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	stats_render(statsdev->sertee, f);
+	if (fclose(f)) {
+		free(snapshot->buf);
+		pool_put(shard, snapshot, sizeof(struct stats_snapshot));
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	
+	fi->fh = (uintptr_t) snapshot;
+	
+	fuse_reply_open(req, fi);
+}
+
+static void stats_release(fuse_req_t req, struct fuse_file_info *fi) {
+	struct sertee_statsdev *statsdev = (struct sertee_statsdev *) fuse_req_userdata(req);
+	struct stats_snapshot *snapshot = (struct stats_snapshot *) (uintptr_t) fi->fh;
+	
+	free(snapshot->buf);
+	pool_put(&statsdev->sertee->shards[0], snapshot, sizeof(struct stats_snapshot));
+	
+	// workaround to call send_ok() as client would hang without it
+	fuse_reply_buf(req, 0, 0);
+}
+
+static void stats_read(fuse_req_t req, size_t size, off_t off,
+						 struct fuse_file_info *fi)
+{
+	struct stats_snapshot *snapshot = (struct stats_snapshot *) (uintptr_t) fi->fh;
+	
+	if (size > snapshot->len - snapshot->pos)
+		size = snapshot->len - snapshot->pos;
+	
+	fuse_reply_buf(req, snapshot->buf + snapshot->pos, size);
+	
+	snapshot->pos += size;
+}
+
+static const struct cuse_lowlevel_ops stats_llops = {
+	.open = stats_open,
+	.release = stats_release,
+	.read = stats_read,
+};
+
+static const char *alarm_names[] = {
+	[ALARM_STALL] = "stall",
+	[ALARM_SATURATION] = "saturation",
+};
+
+static void alarm_open(fuse_req_t req, struct fuse_file_info *fi) {
+	struct sertee_alarmdev *alarmdev = (struct sertee_alarmdev *) fuse_req_userdata(req);
+	struct alarm_reader *reader;
+	
+	// the alarm device is handled by the first shard
+	reader = (struct alarm_reader *) pool_zget(&alarmdev->sertee->shards[0], sizeof(struct alarm_reader));
+	if (!reader) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	
+	// only alarms raised after the open are returned
+	reader->pos = alarmdev->head;
+	
+	reader->next = alarmdev->readers;
+	if (reader->next)
+		reader->next->prev = reader;
+	alarmdev->readers = reader;
+	
+	fi->fh = (uintptr_t) reader;
+	
+	fuse_reply_open(req, fi);
+}
+
+static void alarm_release(fuse_req_t req, struct fuse_file_info *fi) {
+	struct sertee_alarmdev *alarmdev = (struct sertee_alarmdev *) fuse_req_userdata(req);
+	struct alarm_reader *reader = (struct alarm_reader *) (uintptr_t) fi->fh;
+	
+	if (reader->prev)
+		reader->prev->next = reader->next;
+	else
+		alarmdev->readers = reader->next;
+	if (reader->next)
+		reader->next->prev = reader->prev;
+	
+	if (reader->poll_handle)
+		fuse_pollhandle_destroy(reader->poll_handle);
+	pool_put(&alarmdev->sertee->shards[0], reader, sizeof(struct alarm_reader));
+	
+	// workaround to call send_ok() as client would hang without it
+	fuse_reply_buf(req, 0, 0);
+}
+
+static void alarm_read(fuse_req_t req, size_t size, off_t off,
+						 struct fuse_file_info *fi)
+{
+	struct sertee_alarmdev *alarmdev = (struct sertee_alarmdev *) fuse_req_userdata(req);
+	struct alarm_reader *reader = (struct alarm_reader *) (uintptr_t) fi->fh;
+	size_t len;
+	
+	// a slow reader continues with the oldest complete line
+	if (alarmdev->head - reader->pos > ALARM_LOG_SIZE) {
+		reader->pos = alarmdev->head - ALARM_LOG_SIZE;
+		while (reader->pos < alarmdev->head && alarmdev->log[reader->pos++ % ALARM_LOG_SIZE] != '\n') {}
+	}
+	
+	// return at most the data up to the end of the ring
+	len = alarmdev->head - reader->pos;
+	if (len > ALARM_LOG_SIZE - reader->pos % ALARM_LOG_SIZE)
+		len = ALARM_LOG_SIZE - reader->pos % ALARM_LOG_SIZE;
+	if (size > len)
+		size = len;
+	
+	fuse_reply_buf(req, alarmdev->log + reader->pos % ALARM_LOG_SIZE, size);
+	
+	reader->pos += size;
+}
+
+static void alarm_poll(fuse_req_t req, struct fuse_file_info *fi,
+			  struct fuse_pollhandle *ph)
+{
+	struct sertee_alarmdev *alarmdev = (struct sertee_alarmdev *) fuse_req_userdata(req);
+	struct alarm_reader *reader = (struct alarm_reader *) (uintptr_t) fi->fh;
+	unsigned revents = 0;
+	
+	if (ph) {
+		if (reader->poll_handle)
+			fuse_pollhandle_destroy(reader->poll_handle);
+		
+		reader->poll_handle = ph;
+	}
+	
+	if (reader->pos < alarmdev->head)
+		revents |= POLLIN;
+	
+	fuse_reply_poll(req, revents);
+}
+
+static const struct cuse_lowlevel_ops alarm_llops = {
+	.open = alarm_open,
+	.release = alarm_release,
+	.read = alarm_read,
+	.poll = alarm_poll,
+};
+
+static void alarm_append(struct sertee_alarmdev *alarmdev, const char *line, size_t len) {
+	struct alarm_reader *reader;
+	size_t part;
+	
+	if (len > ALARM_LOG_SIZE)
+		len = ALARM_LOG_SIZE;
+	
+	part = ALARM_LOG_SIZE - alarmdev->head % ALARM_LOG_SIZE;
+	if (part > len)
+		part = len;
+	memcpy(alarmdev->log + alarmdev->head % ALARM_LOG_SIZE, line, part);
+	memcpy(alarmdev->log, line + part, len - part);
+	alarmdev->head += len;
+	
+	for (reader = alarmdev->readers; reader; reader = reader->next) {
+		if (reader->poll_handle) {
+			fuse_notify_poll(reader->poll_handle);
+			fuse_pollhandle_destroy(reader->poll_handle);
+			reader->poll_handle = 0;
+		}
+	}
+}
+
+// run the alarm command with the details of the alarm in the environment
+static void alarm_run_exec(struct sertee *sertee, struct sertee_alarm *alarm) {
+	char *argv[] = { "sh", "-c", sertee->alarm_exec, 0 };
+	char *vars[4], **envp;
+	unsigned int i, n_env;
+	pid_t pid;
+	int rv;
+	
+	memset(vars, 0, sizeof(vars));
+	if (asprintf(&vars[0], "SERTEE_SOURCE=%s", alarm->source->source_name) < 0 ||
+		asprintf(&vars[1], "SERTEE_ALARM=%s", alarm_names[alarm->kind]) < 0 ||
+		asprintf(&vars[2], "SERTEE_STATE=%s", alarm->active ? "start" : "end") < 0 ||
+		asprintf(&vars[3], "SERTEE_VALUE=%" PRIu64, alarm->value) < 0)
+	{
+		fprintf(stderr, "asprintf() failed\n");
+		return;
+	}
+	
+	for (n_env = 0; environ[n_env]; n_env++) {}
+	envp = (char **) malloc(sizeof(char *) * (n_env + 5));
+	if (envp) {
+		memcpy(envp, environ, sizeof(char *) * n_env);
+		for (i=0; i < 4; i++)
+			envp[n_env + i] = vars[i];
+		envp[n_env + 4] = 0;
+		
+		// children are reaped automatically as SIGCHLD is ignored
+		rv = posix_spawn(&pid, "/bin/sh", 0, 0, argv, envp);
+		if (rv)
+			fprintf(stderr, "running alarm command failed: %s\n", strerror(rv));
+		
+		free(envp);
+	}
+	
+	for (i=0; i < 4; i++)
+		free(vars[i]);
+}
+
+// report an alarm, called by the first shard
+static void alarm_dispatch(struct sertee_shard *shard, void *arg) {
+	struct sertee_alarm *alarm = (struct sertee_alarm *) arg;
+	struct sertee *sertee = shard->sertee;
+	char line[1024];
+	int len;
+	
+	if (sertee->alarmdev) {
+		len = snprintf(line, sizeof(line), "%" PRIu64 ".%09" PRIu64 " %.512s %s %s %" PRIu64 "\n",
+				alarm->ts / 1000000000, alarm->ts % 1000000000,
+				alarm->source->source_name, alarm_names[alarm->kind],
+				alarm->active ? "start" : "end", alarm->value);
+		if (len > 0)
+			alarm_append(sertee->alarmdev, line, len < sizeof(line) ? len : sizeof(line) - 1);
+	}
+	
+	if (sertee->alarm_exec)
+		alarm_run_exec(sertee, alarm);
+	
+	__atomic_store_n(&alarm->busy, 0, __ATOMIC_RELEASE);
+}
+
+struct metrics_buf {
+	char *buf;
+	size_t size;
+	size_t len;
+};
+
+static void metrics_printf(struct metrics_buf *mb, const char *fmt, ...) {
+	va_list ap;
+	int rv;
+	
+	if (mb->len >= mb->size)
+		return;
+	
+	va_start(ap, fmt);
+	rv = vsnprintf(mb->buf + mb->len, mb->size - mb->len, fmt, ap);
+	va_end(ap);
+	
+	if (rv > 0)
+		mb->len += rv;
+}
+
+// label values may not contain unescaped backslashes, quotes or newlines
+static void metrics_put_label(struct metrics_buf *mb, const char *value) {
+	for (; *value && mb->len + 2 < mb->size; value++) {
+		if (*value == '\\' || *value == '"' || *value == '\n') {
+			mb->buf[mb->len++] = '\\';
+			mb->buf[mb->len++] = *value == '\n' ? 'n' : *value;
+		} else {
+			mb->buf[mb->len++] = *value;
+		}
+	}
+}
+
+// start a sample of a device, the caller adds further labels and the value
+static void metrics_put_dev_labels(struct metrics_buf *mb, const char *name, const char *suffix, struct sertee_dev *sertee_dev) {
+	metrics_printf(mb, "%s%s{dev=\"", name, suffix);
+	metrics_put_label(mb, sertee_dev->dev_name);
+	metrics_printf(mb, "\",source=\"");
+	metrics_put_label(mb, sertee_dev->source->source_name);
+	metrics_printf(mb, "\"");
+}
+
+struct metrics_desc {
+	const char *name;
+	const char *type;
+	const char *help;
+	size_t offset;
+};
+
+#define SOURCE_METRIC(n, t, h, f) { n, t, h, offsetof(struct sertee_source, stats.f) }
+#define DEV_METRIC(n, t, h, f) { n, t, h, offsetof(struct sertee_dev, stats.f) }
+#define SHARD_METRIC(n, t, h, f) { n, t, h, offsetof(struct sertee_shard, stats.f) }
+
+static const struct metrics_desc source_metrics[] = {
+	SOURCE_METRIC("sertee_source_reads_total", "counter", "read() calls that returned data", reads),
+	SOURCE_METRIC("sertee_source_read_bytes_total", "counter", "bytes received from the source", bytes_in),
+	SOURCE_METRIC("sertee_source_writes_total", "counter", "successful write() calls", writes),
+	SOURCE_METRIC("sertee_source_written_bytes_total", "counter", "bytes written to the source", bytes_out),
+	SOURCE_METRIC("sertee_source_write_errors_total", "counter", "failed write() calls", write_errors),
+	SOURCE_METRIC("sertee_source_disconnects_total", "counter", "times the source was closed after an error", disconnects),
+	SOURCE_METRIC("sertee_source_rate_1s_bytes", "gauge", "bytes received per second during the last second", rate_1s),
+	SOURCE_METRIC("sertee_source_rate_10s_bytes", "gauge", "bytes received per second during the last 10 seconds", rate_10s),
+	SOURCE_METRIC("sertee_source_rate_60s_bytes", "gauge", "bytes received per second during the last minute", rate_60s),
+	SOURCE_METRIC("sertee_source_utilization_percent", "gauge", "line utilization during the last second", utilization),
+	SOURCE_METRIC("sertee_source_stalled", "gauge", "1 while the stall alarm is active", stalled),
+	SOURCE_METRIC("sertee_source_saturated", "gauge", "1 while the saturation alarm is active", saturated),
+	SOURCE_METRIC("sertee_source_buffer_grows_total", "counter", "times the buffer grew", grows),
+	SOURCE_METRIC("sertee_source_buffer_shrinks_total", "counter", "times the buffer shrank", shrinks),
+	SOURCE_METRIC("sertee_source_buffer_grow_failures_total", "counter", "times the memory budget did not allow to grow", grow_failures),
+};
+
+static const struct metrics_desc dev_metrics[] = {
+	DEV_METRIC("sertee_dev_reads_total", "counter", "answered read requests", reads),
+	DEV_METRIC("sertee_dev_read_bytes_total", "counter", "bytes returned to readers", bytes_read),
+	DEV_METRIC("sertee_dev_writes_total", "counter", "write requests", writes),
+	DEV_METRIC("sertee_dev_written_bytes_total", "counter", "bytes written by clients", bytes_written),
+	DEV_METRIC("sertee_dev_polls_total", "counter", "poll requests", polls),
+	DEV_METRIC("sertee_dev_notifications_total", "counter", "poll notifications", notifications),
+	DEV_METRIC("sertee_dev_parked_reads_total", "counter", "reads that waited for VMIN/VTIME", parked),
+	DEV_METRIC("sertee_dev_lost_bytes_total", "counter", "bytes overwritten before they were read", lost),
+	DEV_METRIC("sertee_dev_overruns_total", "counter", "times the source overtook the reader", overruns),
+	DEV_METRIC("sertee_dev_lag_bytes", "gauge", "unread bytes of the slowest open file", lag),
+	DEV_METRIC("sertee_dev_lag_max_bytes", "gauge", "largest number of unread bytes seen by a read", lag_max),
+};
+
+static const struct metrics_desc shard_metrics[] = {
+	SHARD_METRIC("sertee_shard_allocations_total", "counter", "objects allocated from the heap", allocations),
+	SHARD_METRIC("sertee_shard_frees_total", "counter", "objects returned to the heap", frees),
+	SHARD_METRIC("sertee_shard_recycled_total", "counter", "objects taken from the pool", recycled),
+	SHARD_METRIC("sertee_shard_cached_objects", "gauge", "free objects kept in the pool", cached),
+	SHARD_METRIC("sertee_shard_capture_drops_total", "counter", "captured chunks dropped as the capture file could not keep up", capture_drops),
+};
+
+#define N_METRICS(a) (sizeof(a) / sizeof((a)[0]))
+
+static const double metrics_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+// upper bound for the size of a single line of the exposition
+#define METRICS_LINE_SIZE 512
+
+static size_t metrics_max_size(struct sertee *sertee) {
+	unsigned int i, n_devs;
+	
+	n_devs = 0;
+	for (i=0; i < sertee->n_sources; i++)
+		n_devs += sertee->sources[i]->n_devs;
+	
+	// every metric has two comment lines and a line per source or device,
+	// plus the two buffer gauges of the sources, the gauges of the memory
+	// budget and the latency summaries
+	return METRICS_HEADER_SIZE + 6 * METRICS_LINE_SIZE +
+		(N_METRICS(source_metrics) + 2) * (sertee->n_sources + 2) * METRICS_LINE_SIZE +
+		N_METRICS(dev_metrics) * (n_devs + 2) * METRICS_LINE_SIZE +
+		N_METRICS(shard_metrics) * (sertee->n_shards + 2) * METRICS_LINE_SIZE +
+		2 * (n_devs * (N_METRICS(metrics_quantiles) + 2) + 2) * METRICS_LINE_SIZE;
+}
+
+static void metrics_render_summary(struct sertee *sertee, struct metrics_buf *mb,
+									const char *name, const char *help, size_t offset)
+{
+	struct sertee_source *source;
+	struct sertee_hist *hist;
+	unsigned int i, j, k;
+	
+	metrics_printf(mb, "# HELP %s %s\n# TYPE %s summary\n", name, help, name);
+	for (i=0; i < sertee->n_sources; i++) {
+		source = sertee->sources[i];
+		
+		for (j=0; j < source->n_devs; j++) {
+			hist = (struct sertee_hist *) ((char *) source->devs[j] + offset);
+			
+			for (k=0; k < N_METRICS(metrics_quantiles); k++) {
+				metrics_put_dev_labels(mb, name, "", source->devs[j]);
+				metrics_printf(mb, ",quantile=\"%g\"} %.9f\n", metrics_quantiles[k],
+					hist_percentile(hist, metrics_quantiles[k]) / 1e9);
+			}
+			
+			metrics_put_dev_labels(mb, name, "_sum", source->devs[j]);
+			metrics_printf(mb, "} %.9f\n", COUNTER_GET(hist->sum) / 1e9);
+			
+			metrics_put_dev_labels(mb, name, "_count", source->devs[j]);
+			metrics_printf(mb, "} %" PRIu64 "\n", COUNTER_GET(hist->count));
+		}
+	}
+}
+
+static void metrics_render(struct sertee *sertee, struct metrics_buf *mb) {
+	struct sertee_source *source;
+	struct sertee_dev *sertee_dev;
+	const struct metrics_desc *desc;
+	uint64_t oldest, fill;
+	unsigned int i, j, k;
+	
+	for (k=0; k < N_METRICS(source_metrics); k++) {
+		desc = &source_metrics[k];
+		
+		metrics_printf(mb, "# HELP %s %s\n# TYPE %s %s\n", desc->name, desc->help, desc->name, desc->type);
+		for (i=0; i < sertee->n_sources; i++) {
+			source = sertee->sources[i];
+			
+			metrics_printf(mb, "%s{source=\"", desc->name);
+			metrics_put_label(mb, source->source_name);
+			metrics_printf(mb, "\"} %" PRIu64 "\n", COUNTER_GET(*(uint64_t *) ((char *) source + desc->offset)));
+		}
+	}
+	
+	metrics_printf(mb, "# HELP sertee_source_buffer_bytes size of the ring buffer\n# TYPE sertee_source_buffer_bytes gauge\n");
+	for (i=0; i < sertee->n_sources; i++) {
+		metrics_printf(mb, "sertee_source_buffer_bytes{source=\"");
+		metrics_put_label(mb, sertee->sources[i]->source_name);
+		metrics_printf(mb, "\"} %zu\n", COUNTER_GET(sertee->sources[i]->ring.size));
+	}
+	
+	metrics_printf(mb, "# HELP sertee_source_buffer_fill_bytes buffered bytes that a new reader can still read\n# TYPE sertee_source_buffer_fill_bytes gauge\n");
+	for (i=0; i < sertee->n_sources; i++) {
+		source = sertee->sources[i];
+		
+		// the source may publish in between, the oldest position is read
+		// first so the difference only grows
+		oldest = sertee_ring_oldest(&source->ring);
+		fill = COUNTER_GET(source->ring.head) - oldest;
+		if (fill > COUNTER_GET(source->ring.size))
+			fill = COUNTER_GET(source->ring.size);
+		
+		metrics_printf(mb, "sertee_source_buffer_fill_bytes{source=\"");
+		metrics_put_label(mb, source->source_name);
+		metrics_printf(mb, "\"} %" PRIu64 "\n", fill);
+	}
+	
+	if (sertee->arena) {
+		metrics_printf(mb, "# HELP sertee_memory_budget_bytes memory shared by the buffers\n# TYPE sertee_memory_budget_bytes gauge\n");
+		metrics_printf(mb, "sertee_memory_budget_bytes %zu\n", sertee->arena->n_chunks * ARENA_CHUNK_SIZE);
+		metrics_printf(mb, "# HELP sertee_memory_used_bytes memory used by the buffers\n# TYPE sertee_memory_used_bytes gauge\n");
+		metrics_printf(mb, "sertee_memory_used_bytes %" PRIu64 "\n", COUNTER_GET(sertee->arena->used));
+	}
+	
+	for (k=0; k < N_METRICS(dev_metrics); k++) {
+		desc = &dev_metrics[k];
+		
+		metrics_printf(mb, "# HELP %s %s\n# TYPE %s %s\n", desc->name, desc->help, desc->name, desc->type);
+		for (i=0; i < sertee->n_sources; i++) {
+			source = sertee->sources[i];
+			
+			for (j=0; j < source->n_devs; j++) {
+				sertee_dev = source->devs[j];
+				
+				metrics_put_dev_labels(mb, desc->name, "", sertee_dev);
+				metrics_printf(mb, "} %" PRIu64 "\n", COUNTER_GET(*(uint64_t *) ((char *) sertee_dev + desc->offset)));
+			}
+		}
+	}
+	
+	metrics_render_summary(sertee, mb, "sertee_dev_read_latency_seconds",
+		"time from the arrival of the oldest unread byte until a read returned it",
+		offsetof(struct sertee_dev, read_latency));
+	metrics_render_summary(sertee, mb, "sertee_dev_notify_latency_seconds",
+		"time from the arrival of the oldest unread byte until the poll notification",
+		offsetof(struct sertee_dev, notify_latency));
+	
+	for (k=0; k < N_METRICS(shard_metrics); k++) {
+		desc = &shard_metrics[k];
+		
+		metrics_printf(mb, "# HELP %s %s\n# TYPE %s %s\n", desc->name, desc->help, desc->name, desc->type);
+		for (i=0; i < sertee->n_shards; i++) {
+			metrics_printf(mb, "%s{shard=\"%u\"} %" PRIu64 "\n", desc->name, i,
+				COUNTER_GET(*(uint64_t *) ((char *) &sertee->shards[i] + desc->offset)));
+		}
+	}
+}
+
+static void metrics_close(struct metrics_conn *conn) {
+	if (conn->fd == -1)
+		return;
+	
+	epoll_ctl(conn->metrics->shard->epoll_fd, EPOLL_CTL_DEL, conn->fd, 0);
+	close(conn->fd);
+	conn->fd = -1;
+}
+
+static void metrics_respond(struct metrics_conn *conn, const char *status) {
+	struct metrics_buf mb;
+	char header[METRICS_HEADER_SIZE];
+	int hlen;
+	
+	mb.buf = conn->out + METRICS_HEADER_SIZE;
+	mb.size = conn->metrics->out_size - METRICS_HEADER_SIZE;
+	mb.len = 0;
+	
+	if (!status) {
+		metrics_render(conn->metrics->sertee, &mb);
+		status = "200 OK";
+		
+		if (mb.len >= mb.size) {
+			fprintf(stderr, "metrics do not fit into the buffer\n");
+			mb.len = 0;
+			status = "500 Internal Server Error";
+		}
+	}
+	
+	hlen = snprintf(header, sizeof(header),
+			"HTTP/1.0 %s\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\n"
+			"Connection: close\r\n\r\n", status, mb.len);
+	
+	conn->out_start = METRICS_HEADER_SIZE - hlen;
+	memcpy(conn->out + conn->out_start, header, hlen);
+	conn->out_len = METRICS_HEADER_SIZE + mb.len;
+	conn->out_off = conn->out_start;
+}
+
+static void metrics_write(struct metrics_conn *conn) {
+	ssize_t srv;
+	
+	while (conn->out_off < conn->out_len) {
+		srv = write(conn->fd, conn->out + conn->out_off, conn->out_len - conn->out_off);
+		if (srv < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return;
+			
+			break;
+		}
+		
+		conn->out_off += srv;
+	}
+	
+	metrics_close(conn);
+}
+
+static void metrics_conn_event(struct metrics_conn *conn, uint32_t events) {
+	ssize_t srv;
+	
+	if (conn->out_len) {
+		metrics_write(conn);
+		return;
+	}
+	
+	srv = read(conn->fd, conn->req + conn->req_len, sizeof(conn->req) - 1 - conn->req_len);
+	if (srv < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (srv <= 0) {
+		metrics_close(conn);
+		return;
+	}
+	conn->req_len += srv;
+	conn->req[conn->req_len] = 0;
+	
+	if (!strstr(conn->req, "\r\n\r\n") && !strstr(conn->req, "\n\n")) {
+		if (conn->req_len < sizeof(conn->req) - 1)
+			return;
+		
+		metrics_respond(conn, "431 Request Header Fields Too Large");
+	} else
+	if (strncmp(conn->req, "GET ", 4)) {
+		metrics_respond(conn, "405 Method Not Allowed");
+	} else
+	if (strncmp(conn->req + 4, "/metrics ", 9) && strncmp(conn->req + 4, "/ ", 2)) {
+		metrics_respond(conn, "404 Not Found");
+	} else {
+		metrics_respond(conn, 0);
+	}
+	
+	conn->eevent.events = EPOLLOUT;
+	if (epoll_ctl(conn->metrics->shard->epoll_fd, EPOLL_CTL_MOD, conn->fd, &conn->eevent)) {
+		metrics_close(conn);
+		return;
+	}
+	
+	metrics_write(conn);
+}
+
+static void metrics_accept(struct sertee_metrics *metrics) {
+	struct metrics_conn *conn;
+	unsigned int i;
+	int fd;
+	
+	fd = accept4(metrics->fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			fprintf(stderr, "accept() failed: %s\n", strerror(errno));
+		return;
+	}
+	
+	for (i=0; i < METRICS_MAX_CONNS; i++) {
+		if (metrics->conns[i].fd == -1)
+			break;
+	}
+	
+	// if all connections are busy, drop the oldest one
+	if (i == METRICS_MAX_CONNS) {
+		i = metrics->next_conn;
+		metrics_close(&metrics->conns[i]);
+	}
+	metrics->next_conn = (i + 1) % METRICS_MAX_CONNS;
+	
+	conn = &metrics->conns[i];
+	conn->fd = fd;
+	conn->req_len = 0;
+	conn->out_len = 0;
+	conn->eevent.events = EPOLLIN;
+	
+	if (epoll_ctl(metrics->shard->epoll_fd, EPOLL_CTL_ADD, fd, &conn->eevent)) {
+		fprintf(stderr, "epoll_ctl(metrics) failed: %s\n", strerror(errno));
+		close(fd);
+		conn->fd = -1;
+	}
+}
+
+static const struct {
+	unsigned int baud;
+	speed_t speed;
+} sertee_bauds[] = {
+	{ 50, B50 }, { 75, B75 }, { 110, B110 }, { 134, B134 }, { 150, B150 },
+	{ 200, B200 }, { 300, B300 }, { 600, B600 }, { 1200, B1200 },
+	{ 1800, B1800 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+	{ 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+	{ 115200, B115200 }, { 230400, B230400 }, { 460800, B460800 },
+	{ 500000, B500000 }, { 576000, B576000 }, { 921600, B921600 },
+	{ 1000000, B1000000 }, { 1152000, B1152000 }, { 1500000, B1500000 },
+	{ 2000000, B2000000 }, { 2500000, B2500000 }, { 3000000, B3000000 },
+	{ 3500000, B3500000 }, { 4000000, B4000000 },
+};
+
+// change the line settings in t according to the options of the source
+static int source_build_termios(struct sertee_source *source, struct termios *t) {
+	unsigned int i;
+	const char *f;
+	
+	if (source->raw)
+		cfmakeraw(t);
+	
+	if (source->baud) {
+		for (i=0; i < sizeof(sertee_bauds) / sizeof(sertee_bauds[0]); i++) {
+			if (sertee_bauds[i].baud == source->baud)
+				break;
+		}
+		if (i == sizeof(sertee_bauds) / sizeof(sertee_bauds[0])) {
+			fprintf(stderr, "error, unsupported baud rate %u\n", source->baud);
+			return 1;
+		}
+		
+		cfsetispeed(t, sertee_bauds[i].speed);
+		cfsetospeed(t, sertee_bauds[i].speed);
+	}
+	
+	if (source->framing) {
+		f = source->framing;
+		if (strlen(f) != 3 || f[0] < '5' || f[0] > '8' || !strchr("NEO", f[1]) || (f[2] != '1' && f[2] != '2')) {
+			fprintf(stderr, "error, invalid framing \"%s\"\n", f);
+			return 1;
+		}
+		
+		t->c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB);
+		t->c_cflag |= f[0] == '5' ? CS5 : f[0] == '6' ? CS6 : f[0] == '7' ? CS7 : CS8;
+		if (f[1] != 'N')
+			t->c_cflag |= PARENB;
+		if (f[1] == 'O')
+			t->c_cflag |= PARODD;
+		if (f[2] == '2')
+			t->c_cflag |= CSTOPB;
+	}
+	
+	if (source->flow) {
+		t->c_cflag &= ~CRTSCTS;
+		t->c_iflag &= ~(IXON | IXOFF | IXANY);
+		
+		if (!strcmp(source->flow, "rtscts")) {
+			t->c_cflag |= CRTSCTS;
+		} else
+		if (!strcmp(source->flow, "xonxoff")) {
+			t->c_iflag |= IXON | IXOFF;
+		} else
+		if (strcmp(source->flow, "none")) {
+			fprintf(stderr, "error, invalid flow control \"%s\"\n", source->flow);
+			return 1;
+		}
+	}
+	
+	// poll() of a terminal only waits for VMIN bytes if VTIME is zero, hence
+	// sertee implements VTIME itself with the flush timer
+	if (source->source_vmin >= 0)
+		t->c_cc[VMIN] = source->source_vmin;
+	if (source->source_vmin >= 0 || source->source_vtime >= 0)
+		t->c_cc[VTIME] = 0;
+	
+	if (source->raw || source->baud || source->framing || source->flow)
+		t->c_cflag |= CLOCAL | CREAD;
+	
+	return 0;
+}
+
+// apply the line settings of the source options
+static void source_configure(struct sertee_source *source) {
+	struct termios t;
+	struct serial_struct serial;
+	
+	if (source->raw || source->baud || source->framing || source->flow || source->source_vmin >= 0 || source->source_vtime >= 0) {
+		if (tcgetattr(source->source_fd, &t)) {
+			fprintf(stderr, "tcgetattr(%s) failed: %s\n", source->source_name, strerror(errno));
+		} else {
+			source_build_termios(source, &t);
+			
+			if (tcsetattr(source->source_fd, TCSANOW, &t))
+				fprintf(stderr, "tcsetattr(%s) failed: %s\n", source->source_name, strerror(errno));
+		}
+	}
+	
+	// e.g. reduces the latency timer of FTDI adapters to 1 ms
+	if (source->low_latency) {
+		if (ioctl(source->source_fd, TIOCGSERIAL, &serial) == 0) {
+			serial.flags |= ASYNC_LOW_LATENCY;
+			if (ioctl(source->source_fd, TIOCSSERIAL, &serial))
+				fprintf(stderr, "enabling low latency for %s failed: %s\n", source->source_name, strerror(errno));
+		} else {
+			fprintf(stderr, "%s does not support low latency mode: %s\n", source->source_name, strerror(errno));
+		}
+	}
+	
+	source->termios_valid = 0;
+	source->modem_ts = 0;
+}
+
+// change the state of an alarm of the source and pass it to the first shard
+// that reports it
+static void source_alarm(struct sertee_source *source, enum alarm_kind kind, int active, uint64_t value) {
+	struct sertee *sertee = source->sertee;
+	struct sertee_alarm *alarm;
+	
+	__atomic_store_n(kind == ALARM_STALL ? &source->stats.stalled : &source->stats.saturated, active, __ATOMIC_RELAXED);
+	EVENT(source->shard, EV_ALARM, source->id, kind, active, value);
+	
+	fprintf(stderr, "source \"%s\": %s %s (%" PRIu64 ")\n", source->source_name,
+		alarm_names[kind], active ? "start" : "end", value);
+	
+	if (!sertee->alarmdev && !sertee->alarm_exec)
+		return;
+	
+	// the alarm is dropped if the first shard did not report the alarms
+	// that used all records before
+	alarm = &source->alarms[source->alarm_pos % ALARM_RECORDS];
+	if (__atomic_load_n(&alarm->busy, __ATOMIC_ACQUIRE))
+		return;
+	source->alarm_pos += 1;
+	
+	alarm->busy = 1;
+	alarm->source = source;
+	alarm->kind = kind;
+	alarm->active = active;
+	alarm->value = value;
+	alarm->ts = sertee_now();
+	
+	// the first shard reports it directly. Other shards do not wait for the
+	// first one, the alarm is dropped if its command pipe is full.
+	if (source->shard == &sertee->shards[0])
+		alarm_dispatch(source->shard, alarm);
+	else
+	if (sertee_shard_try_call(&sertee->shards[0], alarm_dispatch, alarm))
+		alarm->busy = 0;
+}
+
+// bits per second of the line and bits per character, the rate is 0 if it
+// is unknown
+static unsigned int source_line_rate(struct sertee_source *source, unsigned int *bits) {
+	unsigned int i, baud;
+	tcflag_t cflag;
+	
+	baud = source->baud;
+	*bits = 10;
+	
+	if (source->source_fd == -1 || source_get_termios(source))
+		return baud;
+	
+	// start bit, data bits, parity and stop bits
+	cflag = source->termios.c_cflag;
+	*bits = 1 + ((cflag & CSIZE) == CS5 ? 5 : (cflag & CSIZE) == CS6 ? 6 : (cflag & CSIZE) == CS7 ? 7 : 8) +
+		(cflag & PARENB ? 1 : 0) + (cflag & CSTOPB ? 2 : 1);
+	
+	if (!baud) {
+		for (i=0; i < sizeof(sertee_bauds) / sizeof(sertee_bauds[0]); i++) {
+			if (sertee_bauds[i].speed == (cflag & CBAUD))
+				baud = sertee_bauds[i].baud;
+		}
+	}
+	
+	return baud;
+}
+
+// average byte rate of the last n seconds
+static uint64_t source_window_rate(struct sertee_source *source, unsigned int n) {
+	uint64_t sum;
+	unsigned int i;
+	
+	if (n > source->window_pos)
+		n = source->window_pos;
+	if (n == 0)
+		return 0;
+	
+	sum = 0;
+	for (i=1; i <= n; i++)
+		sum += source->window[(source->window_pos - i) % LIVENESS_SLOTS];
+	
+	return sum / n;
+}
+
+// move the ring of the source into a new buffer of size bytes from the
+// memory budget, the devices keep their offsets
+static int source_resize(struct sertee_source *source, size_t size) {
+	struct sertee_arena *arena = source->sertee->arena;
+	size_t old_size;
+	char *buf;
+	
+	buf = arena_alloc(arena, size);
+	if (!buf)
+		return -1;
+	
+	old_size = source->ring.size;
+	buf = sertee_ring_resize(&source->ring, buf, size);
+	arena_free(arena, buf, old_size);
+	
+	EVENT(source->shard, EV_RESIZE, source->id, old_size, size, 0);
+	
+	return 0;
+}
+
+// grow the ring while readers lose data or come close to it, shrink it once
+// they stayed far behind the source for a while
+static void source_arena_tick(struct sertee_source *source) {
+	struct sertee_dev *sertee_dev;
+	uint64_t overruns;
+	size_t lag, lag_max, lowat_max, size;
+	unsigned int i;
+	
+	overruns = 0;
+	lag_max = 0;
+	lowat_max = 0;
+	for (i=0; i < source->n_devs; i++) {
+		sertee_dev = source->devs[i];
+		
+		overruns += sertee_dev->stats.overruns;
+		if (sertee_dev->n_clients <= 0)
+			continue;
+		
+		lag = dev_lag(sertee_dev);
+		if (lag > lag_max)
+			lag_max = lag;
+		if (sertee_dev->lowat > lowat_max)
+			lowat_max = sertee_dev->lowat;
+	}
+	
+	if ((overruns != source->arena_overruns || lag_max > source->ring.size / 4 * 3) &&
+		(!source->bufsize_max || source->ring.size < source->bufsize_max))
+	{
+		size = source->ring.size * 2;
+		if (source->bufsize_max && size > source->bufsize_max)
+			size = source->bufsize_max;
+		
+		if (source_resize(source, size))
+			COUNTER_ADD(source->stats.grow_failures, 1);
+		else
+			COUNTER_ADD(source->stats.grows, 1);
+		source->arena_calm = 0;
+	} else
+	if (source->ring.size > source->bufsize_min && lag_max < source->ring.size / 4) {
+		source->arena_calm += 1;
+		if (source->arena_calm >= ARENA_SHRINK_DELAY) {
+			// a reader waiting for lowat bytes needs them in the buffer
+			size = arena_round(source->ring.size / 2);
+			if (size < source->bufsize_min)
+				size = source->bufsize_min;
+			if (size < lowat_max)
+				size = arena_round(lowat_max);
+			
+			if (size < source->ring.size && source_resize(source, size) == 0)
+				COUNTER_ADD(source->stats.shrinks, 1);
+			source->arena_calm = 0;
+		}
+	} else {
+		source->arena_calm = 0;
+	}
+	
+	source->arena_overruns = overruns;
+}
+
+// called every second to update the byte rates and to check for alarms
+static void source_liveness_tick(struct sertee_timer *timer) {
+	struct sertee_source *source = container_of(timer, struct sertee_source, liveness_timer);
+	uint64_t bytes, utilization, idle, now;
+	unsigned int baud, bits;
+	
+	sertee_timer_add(source, &source->liveness_timer, 1000000000ULL);
+	
+	bytes = source->stats.bytes_in;
+	source->window[source->window_pos % LIVENESS_SLOTS] = bytes - source->window_bytes;
+	source->window_bytes = bytes;
+	source->window_pos += 1;
+	
+	__atomic_store_n(&source->stats.rate_1s, source_window_rate(source, 1), __ATOMIC_RELAXED);
+	__atomic_store_n(&source->stats.rate_10s, source_window_rate(source, 10), __ATOMIC_RELAXED);
+	__atomic_store_n(&source->stats.rate_60s, source_window_rate(source, 60), __ATOMIC_RELAXED);
+	
+	utilization = 0;
+	baud = source_line_rate(source, &bits);
+	if (baud)
+		utilization = source->stats.rate_1s * bits * 100 / baud;
+	__atomic_store_n(&source->stats.utilization, utilization, __ATOMIC_RELAXED);
+	
+	if (source->saturation && (utilization >= source->saturation) != source->stats.saturated)
+		source_alarm(source, ALARM_SATURATION, utilization >= source->saturation, utilization);
+	
+	now = sertee_now();
+	idle = now > source->stats.last_rx ? (now - source->stats.last_rx) / 1000000 : 0;
+	if (source->stall && !source->stats.stalled && idle >= source->stall)
+		source_alarm(source, ALARM_STALL, 1, idle);
+	
+	if (source->sertee->arena)
+		source_arena_tick(source);
+}
+
+// parse the generator option "name=N" with a decimal number up to max
+static int gen_parse_num(const char *it, const char *name, uint64_t max, uint64_t *value) {
+	size_t len = strlen(name);
+	char *end;
+	
+	if (strncmp(it, name, len) || it[len] != '=')
+		return -1;
+	it += len + 1;
+	
+	// strtoull() also accepts whitespace and a sign
+	if (*it < '0' || *it > '9')
+		return -1;
+	
+	errno = 0;
+	*value = strtoull(it, &end, 10);
+	if (*end || errno || *value > max)
+		return -1;
+	
+	return 0;
+}
+
+// parse gen:PATTERN[:rate=BPS][:chunk=N][:burst=N]
+static int gen_parse(struct sertee_source *source) {
+	struct sertee_gen *gen;
+	char *spec, *it, *saveit;
+	unsigned int i;
+	uint64_t value;
+	int rv;
+	
+	gen = (struct sertee_gen *) calloc(1, sizeof(struct sertee_gen));
+	spec = strdup(source->source_name + 4);
+	if (!gen || !spec) {
+		free(gen);
+		free(spec);
+		return 1;
+	}
+	gen->pattern = GEN_PATTERNS;
+	gen->chunk = source->read_chunk ? source->read_chunk : DEFAULT_GEN_CHUNK;
+	gen->burst = 1;
+	gen->rng = 0x9e3779b97f4a7c15ULL ^ source->id;
+	
+	rv = 0;
+	it = strtok_r(spec, ":", &saveit);
+	for (i=0; it && i < GEN_PATTERNS; i++) {
+		if (!strcmp(it, gen_pattern_names[i]))
+			gen->pattern = i;
+	}
+	if (gen->pattern == GEN_PATTERNS) {
+		fprintf(stderr, "error, unknown generator pattern in \"%s\"\n", source->source_name);
+		rv = 1;
+	}
+	
+	while (rv == 0 && (it = strtok_r(0, ":", &saveit))) {
+		if (gen_parse_num(it, "rate", UINT64_MAX, &value) == 0) {
+			gen->rate = value;
+			continue;
+		}
+		if (gen_parse_num(it, "chunk", SIZE_MAX, &value) == 0 && value > 0) {
+			gen->chunk = value;
+			continue;
+		}
+		if (gen_parse_num(it, "burst", UINT_MAX, &value) == 0 && value > 0) {
+			gen->burst = value;
+			continue;
+		}
+		
+		fprintf(stderr, "error, invalid generator option \"%s\" in \"%s\"\n", it, source->source_name);
+		rv = 1;
+	}
+	
+	free(spec);
+	if (rv) {
+		free(gen);
+		return rv;
+	}
+	
+	source->gen = gen;
+	
+	return 0;
+}
+
+// a paced generator is woken up by a timer once per burst, an unpaced one by
+// an eventfd that always stays readable
+static int gen_open(struct sertee_source *source) {
+	struct sertee_gen *gen = source->gen;
+	struct itimerspec its;
+	struct timespec now;
+	uint64_t tick;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	gen->start = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+	gen->generated = 0;
+	
+	if (gen->rate == 0) {
+		source->source_fd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+		return source->source_fd == -1 ? errno : 0;
+	}
+	
+	source->source_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (source->source_fd == -1)
+		return errno;
+	
+	tick = (uint64_t) ((double) gen->chunk * gen->burst * 1e9 / gen->rate);
+	if (tick < 100000)
+		tick = 100000;
+	if (tick > 1000000000)
+		tick = 1000000000;
+	
+	its.it_interval.tv_sec = tick / 1000000000;
+	its.it_interval.tv_nsec = tick % 1000000000;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(source->source_fd, 0, &its, 0)) {
+		close(source->source_fd);
+		source->source_fd = -1;
+		return errno;
+	}
+	
+	return 0;
+}
+
+static void gen_next_record(struct sertee_gen *gen) {
+	uint64_t r;
+	size_t i, len;
+	uint8_t sum;
+	
+	gen->rec_pos = 0;
+	gen->seq += 1;
+	
+	switch (gen->pattern) {
+		case GEN_COUNTER:
+			if (gen->rec_len == GEN_MAX_RECORD)
+				break;
+			for (i=0; i < GEN_MAX_RECORD; i++)
+				gen->rec[i] = i;
+			gen->rec_len = GEN_MAX_RECORD;
+			break;
+		case GEN_TEXT:
+			gen->rec_len = snprintf(gen->rec, sizeof(gen->rec),
+				"%010" PRIu64 " the quick brown fox jumps over the lazy dog\r\n", gen->seq);
+			break;
+		case GEN_BINARY:
+			// 0x7e, payload length, random payload, sum of the payload
+			r = gen->rng;
+			r ^= r << 13;
+			r ^= r >> 7;
+			r ^= r << 17;
+			gen->rng = r;
+			
+			len = 4 + r % (GEN_MAX_RECORD - 7);
+			gen->rec[0] = 0x7e;
+			gen->rec[1] = len;
+			sum = 0;
+			for (i=0; i < len; i++) {
+				if (i % 8 == 0) {
+					r ^= r << 13;
+					r ^= r >> 7;
+					r ^= r << 17;
+				}
+				gen->rec[2 + i] = r >> (i % 8 * 8);
+				sum += (uint8_t) gen->rec[2 + i];
+			}
+			gen->rec[2 + len] = sum;
+			gen->rec_len = 3 + len;
+			break;
+		default:
+			gen->rec_len = 0;
+	}
+}
+
+static void gen_fill(struct sertee_gen *gen, char *data, size_t len) {
+	size_t n;
+	
+	while (len) {
+		if (gen->rec_pos == gen->rec_len)
+			gen_next_record(gen);
+		
+		n = gen->rec_len - gen->rec_pos;
+		if (n > len)
+			n = len;
+		memcpy(data, gen->rec + gen->rec_pos, n);
+		gen->rec_pos += n;
+		data += n;
+		len -= n;
+	}
+}
+
+static int source_open(struct sertee_source *source) {
+	int rv;
+	
+	if (source->gen) {
+		rv = gen_open(source);
+		if (rv)
+			return rv;
+	} else {
+		source->source_fd = open(source->source_name, O_RDWR | O_NOCTTY | O_SYNC | O_NONBLOCK);
+		if (source->source_fd == -1)
+			return errno;
+		
+		source_configure(source);
+	}
+	
+	source->source_eevent.events = EPOLLIN;
+	source->source_eevent.data.ptr = source;
+	
+	if (epoll_ctl(source->shard->epoll_fd, EPOLL_CTL_ADD, source->source_fd, &source->source_eevent)) {
+		fprintf(stderr, "epoll_ctl(source) failed: %s\n", strerror(errno));
+		close(source->source_fd);
+		source->source_fd = -1;
+		return EIO;
+	}
+	
+	if (source->source_vmin > 1 && source->source_vtime > 0) {
+		sertee_timer_add(source, &source->flush_timer, source->source_vtime * 100000000ULL);
+	}
+	
+	return 0;
+}
+
+// close a source that failed, readers keep their data and writers get EIO
+static void source_disconnect(struct sertee_source *source) {
+	if (epoll_ctl(source->shard->epoll_fd, EPOLL_CTL_DEL, source->source_fd, 0))
+		fprintf(stderr, "epoll_ctl(source) failed: %s\n", strerror(errno));
+	close(source->source_fd);
+	source->source_fd = -1;
+	source->source_eevent.events = 0;
+	COUNTER_ADD(source->stats.disconnects, 1);
+	EVENT(source->shard, EV_DISCONNECT, source->id, source->ring.head, 0, 0);
+	
+	sertee_timer_del(source, &source->flush_timer);
+	
+	source_write(source);
+	
+	if (source->reconnect) {
+		fprintf(stderr, "source \"%s\" disconnected, reconnecting every %u ms\n", source->source_name, source->reconnect);
+		
+		sertee_timer_add(source, &source->reconnect_timer, source->reconnect * 1000000ULL);
+	} else {
+		fprintf(stderr, "source \"%s\" disconnected\n", source->source_name);
+	}
+}
+
+// add a chunk that was placed at the head of the ring, update the chunk
+// index and statistics and wake up the readers
+static void source_publish(struct sertee_source *source, char *data, size_t len) {
+	struct sertee_dev *sertee_dev;
+	struct sertee_handle *handle;
+	struct tsdev_reader *ts_reader;
+	struct ts_chunk *chunk;
+	uint64_t ts;
+	int i;
+	
+	ts = sertee_now();
+	
+	if (source->stats.stalled)
+		source_alarm(source, ALARM_STALL, 0, ts > source->stats.last_rx ? (ts - source->stats.last_rx) / 1000000 : 0);
+	__atomic_store_n(&source->stats.last_rx, ts, __ATOMIC_RELAXED);
+	
+	TRACE(source_read, source->source_name, len, source->ring.head);
+	EVENT(source->shard, EV_SOURCE_READ, source->id, len, source->ring.head, data - source->ring.buf);
+	
+	chunk = &source->chunks[source->chunk_head % source->n_chunks];
+	chunk->off = source->ring.head;
+	chunk->ts = ts;
+	source->chunk_head += 1;
+	
+	record_traffic(source, MONITOR_RX, source->source_name, 0, data, len, ts);
+	
+	// devices that we overtake lose the oldest data, see dev_overrun()
+	sertee_ring_commit(&source->ring, len);
+	COUNTER_ADD(source->stats.reads, 1);
+	COUNTER_ADD(source->stats.bytes_in, len);
+	
+	for (i=0; i < source->n_devs; i++) {
+		sertee_dev = source->devs[i];
+		
+		if (sertee_dev->tsdev) {
+			for (ts_reader = sertee_dev->tsdev->readers; ts_reader; ts_reader = ts_reader->next) {
+				if (ts_reader->poll_handle) {
+					fuse_notify_poll(ts_reader->poll_handle);
+					fuse_pollhandle_destroy(ts_reader->poll_handle);
+					ts_reader->poll_handle = 0;
+				}
+			}
+		}
+		
+		// closed devices have no cursor in the ring
+		if (sertee_dev->n_clients == 0)
+			continue;
+		
+		// lag as seen by other threads
+		__atomic_store_n(&sertee_dev->stats.lag, dev_lag(sertee_dev), __ATOMIC_RELAXED);
+		
+		// the list only changes in this thread, so no lock is needed here
+		for (handle = sertee_dev->handles; handle; handle = handle->next) {
+			if (!handle->poll_handle || !handle_readable(handle))
+				continue;
+			
+			dev_record_latency(handle, &sertee_dev->notify_latency, get_lag(handle));
+			TRACE(notify, sertee_dev->dev_name, get_lag(handle));
+			EVENT(source->shard, EV_NOTIFY, sertee_dev->id, get_lag(handle), 0, 0);
+			fuse_notify_poll(handle->poll_handle);
+			fuse_pollhandle_destroy(handle->poll_handle);
+			COUNTER_ADD(sertee_dev->stats.notifications, 1);
+			handle->poll_handle = 0;
+		}
+		
+		if (sertee_dev->parked)
+			dev_wake_parked(sertee_dev);
+	}
+}
+
+// produce the bytes that are due, in chunks like reads of a device
+static void source_generate(struct sertee_source *source) {
+	struct sertee_gen *gen = source->gen;
+	struct timespec now;
+	uint64_t expirations, due, unit;
+	size_t len;
+	char *data;
+	
+	if (gen->rate) {
+		// the timer only wakes us up, the amount follows from the clock
+		if (read(source->source_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+			fprintf(stderr, "read() from generator timer failed: %s\n", strerror(errno));
+		
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		due = (uint64_t) (((uint64_t) now.tv_sec * 1000000000 + now.tv_nsec - gen->start) / 1e9 * gen->rate);
+		unit = gen->chunk * gen->burst;
+		due -= due % unit;
+	} else {
+		due = gen->generated + source->ring.size;
+	}
+	
+	// give the devices a chance between two rings full of data
+	if (due > gen->generated + source->ring.size)
+		due = gen->generated + source->ring.size;
+	
+	while (gen->generated < due) {
+		data = sertee_ring_reserve(&source->ring, &len);
+		if (len > gen->chunk)
+			len = gen->chunk;
+		if (len > due - gen->generated)
+			len = due - gen->generated;
+		
+		gen_fill(gen, data, len);
+		gen->generated += len;
+		
+		source_publish(source, data, len);
+	}
+}
+
+void source_read(struct sertee_source *source) {
+	ssize_t srv;
+	size_t len;
+	char *data;
+	
+	// pending events after the source was closed
+	if (source->source_fd == -1)
+		return;
+	
+	if (source->gen) {
+		source_generate(source);
+		return;
+	}
+	
+	while (1) {
+		data = sertee_ring_reserve(&source->ring, &len);
+		if (source->read_chunk && len > source->read_chunk)
+			len = source->read_chunk;
+		
+		srv = read(source->source_fd, data, len);
+		if (srv < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			
+			// e.g. EIO after the other side of a pty was closed
+			fprintf(stderr, "read() from source failed: %s\n", strerror(errno));
+			source_disconnect(source);
+			return;
+		}
+		if (srv == 0)
+			break;
+		
+		source_publish(source, data, srv);
+	}
+}
+
+// with VMIN, the kernel only wakes us if enough data is available. As VTIME
+// has no effect on poll(), we look for the rest periodically
+static void source_flush_timeout(struct sertee_timer *timer) {
+	struct sertee_source *source = container_of(timer, struct sertee_source, flush_timer);
+	
+	sertee_timer_add(source, &source->flush_timer, source->source_vtime * 100000000ULL);
+	
+	source_read(source);
+}
+
+static void source_reconnect(struct sertee_timer *timer) {
+	struct sertee_source *source = container_of(timer, struct sertee_source, reconnect_timer);
+	
+	if (source_open(source)) {
+		sertee_timer_add(source, &source->reconnect_timer, source->reconnect * 1000000ULL);
+		return;
+	}
+	
+	fprintf(stderr, "source \"%s\" reconnected\n", source->source_name);
+	EVENT(source->shard, EV_RECONNECT, source->id, source->ring.head, 0, 0);
+	
+	// there might be data already
+	source_read(source);
+}
+
+// writes the batches of the shards into the capture file
+static void *sertee_capture_thread(void *arg) {
+	struct sertee *sertee = (struct sertee *) arg;
+	struct capture_batch *batch;
+	ssize_t srv;
+	size_t done;
+	
+	while (read(sertee->capture_fds[0], &batch, sizeof(batch)) == sizeof(batch)) {
+		// a NULL batch tells us to stop
+		if (!batch)
+			break;
+		
+		done = 0;
+		while (done < batch->len) {
+			srv = write(sertee->capture_fd, batch->data + done, batch->len - done);
+			if (srv < 0) {
+				if (errno == EINTR)
+					continue;
+				
+				fprintf(stderr, "writing capture failed: %s\n", strerror(errno));
+				break;
+			}
+			done += srv;
+		}
+		
+		// the pipe holds far more than the CAPTURE_BATCHES of a shard
+		batch->len = 0;
+		if (write(batch->shard->capture_free_fds[1], &batch, sizeof(batch)) != sizeof(batch))
+			fprintf(stderr, "returning capture batch failed: %s\n", strerror(errno));
+	}
+	
+	return 0;
+}
+
+// open the capture file and write the section header and one interface
+// description per source
+static int sertee_capture_setup(struct sertee *sertee) {
+	struct capture_batch *batch;
+	char buf[4096];
+	size_t pos;
+	uint32_t u32;
+	uint16_t u16[2];
+	int64_t section_len;
+	uint8_t tsresol;
+	unsigned int i, j;
+	int rv;
+	
+	sertee->capture_fd = open(sertee->capture, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (sertee->capture_fd < 0) {
+		fprintf(stderr, "opening capture \"%s\" failed: %s\n", sertee->capture, strerror(errno));
+		return 1;
+	}
+	
+	pos = 8;
+	u32 = 0x1A2B3C4D;
+	memcpy(buf + pos, &u32, 4);
+	u16[0] = 1;
+	u16[1] = 0;
+	memcpy(buf + pos + 4, u16, 4);
+	section_len = -1;
+	memcpy(buf + pos + 8, &section_len, 8);
+	pos += 16;
+	pcapng_finish_block(buf, PCAPNG_SHB, pos - 8);
+	
+	if (write(sertee->capture_fd, buf, pos + 4) != pos + 4) {
+		fprintf(stderr, "writing capture header failed: %s\n", strerror(errno));
+		return 1;
+	}
+	
+	for (i=0; i < sertee->n_sources; i++) {
+		pos = 8;
+		u16[0] = PCAPNG_LINKTYPE_USER0;
+		u16[1] = 0;
+		memcpy(buf + pos, u16, 4);
+		u32 = 0;
+		memcpy(buf + pos + 4, &u32, 4);
+		pos += 8;
+		
+		pos += pcapng_put_opt(buf + pos, PCAPNG_OPT_IF_NAME, sertee->sources[i]->source_name,
+					strnlen(sertee->sources[i]->source_name, 1024));
+		tsresol = 9;
+		pos += pcapng_put_opt(buf + pos, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+		pos += pcapng_put_opt(buf + pos, PCAPNG_OPT_END, 0, 0);
+		pcapng_finish_block(buf, PCAPNG_IDB, pos - 8);
+		
+		if (write(sertee->capture_fd, buf, pos + 4) != pos + 4) {
+			fprintf(stderr, "writing capture header failed: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+	
+	// the shards never wait for the capture thread, only the reading end
+	// blocks
+	if (pipe2(sertee->capture_fds, O_NONBLOCK | O_CLOEXEC)) {
+		fprintf(stderr, "pipe2 failed: %s\n", strerror(errno));
+		return 1;
+	}
+	fcntl(sertee->capture_fds[0], F_SETFL, fcntl(sertee->capture_fds[0], F_GETFL) & ~O_NONBLOCK);
+	
+	// every shard gets a fixed set of batches, so a slow disk costs records
+	// and not memory
+	for (i=0; i < sertee->n_shards; i++) {
+		if (pipe2(sertee->shards[i].capture_free_fds, O_NONBLOCK | O_CLOEXEC)) {
+			fprintf(stderr, "pipe2 failed: %s\n", strerror(errno));
+			return 1;
+		}
+		
+		for (j=0; j < CAPTURE_BATCHES; j++) {
+			batch = (struct capture_batch *) malloc(sizeof(struct capture_batch));
+			if (!batch) {
+				fprintf(stderr, "allocating capture batches failed\n");
+				return 1;
+			}
+			batch->shard = &sertee->shards[i];
+			
+			if (write(sertee->shards[i].capture_free_fds[1], &batch, sizeof(batch)) != sizeof(batch)) {
+				fprintf(stderr, "queueing capture batch failed: %s\n", strerror(errno));
+				free(batch);
+				return 1;
+			}
+		}
+	}
+	
+	rv = pthread_create(&sertee->capture_thread, 0, sertee_capture_thread, sertee);
+	if (rv) {
+		fprintf(stderr, "pthread_create failed: %s\n", strerror(rv));
+		return 1;
+	}
+	
+	return 0;
+}
+
+static void shard_process_cmds(struct sertee_shard *shard) {
+	struct sertee_cmd cmd;
+	
+	while (read(shard->cmd_fds[0], &cmd, sizeof(cmd)) == sizeof(cmd))
+		cmd.fn(shard, cmd.arg);
+}
+
+static void shard_stop(struct sertee_shard *shard, void *arg) {
+	shard->stop = 1;
+}
+
+static int sertee_source_watch(struct sertee_source *source, int op) {
+	int i;
+	struct sertee_dev *sertee_dev;
+	
+	if (source->source_fd != -1 && epoll_ctl(source->shard->epoll_fd, op, source->source_fd, op == EPOLL_CTL_DEL ? 0 : &source->source_eevent)) {
+		fprintf(stderr, "epoll_ctl(source) failed: %s\n", strerror(errno));
+		return 1;
+	}
+	
+	if (epoll_ctl(source->shard->epoll_fd, op, source->timer_fd, op == EPOLL_CTL_DEL ? 0 : &source->timer_eevent)) {
+		fprintf(stderr, "epoll_ctl(timer) failed: %s\n", strerror(errno));
+		return 1;
+	}
+	
+	for (i=0; i < source->n_devs; i++) {
+		sertee_dev = source->devs[i];
+		
+		if (epoll_ctl(source->shard->epoll_fd, op, fuse_session_fd(sertee_dev->fsess), op == EPOLL_CTL_DEL ? 0 : &sertee_dev->eevent)) {
+			fprintf(stderr, "epoll_ctl(%s) failed: %s\n", sertee_dev->name, strerror(errno));
+			return 1;
+		}
+		
+		if (sertee_dev->tsdev && epoll_ctl(source->shard->epoll_fd, op, fuse_session_fd(sertee_dev->tsdev->fsess), op == EPOLL_CTL_DEL ? 0 : &sertee_dev->tsdev->eevent)) {
+			fprintf(stderr, "epoll_ctl(%s) failed: %s\n", sertee_dev->tsdev->name, strerror(errno));
+			return 1;
+		}
+	}
+	
+	if (source->monitor) {
+		if (epoll_ctl(source->shard->epoll_fd, op, fuse_session_fd(source->monitor->fsess), op == EPOLL_CTL_DEL ? 0 : &source->monitor->eevent)) {
+			fprintf(stderr, "epoll_ctl(%s) failed: %s\n", source->monitor->name, strerror(errno));
+			return 1;
+		}
+	}
+	
+	return 0;
+}
+
+static void shard_notify_supervisor(struct sertee_shard *shard, char c) {
+	if (write(shard->sertee->supervisor_fds[1], &c, 1) != 1)
+		fprintf(stderr, "notifying supervisor failed: %s\n", strerror(errno));
+}
+
+static void shard_attach_source(struct sertee_shard *shard, void *arg) {
+	struct sertee_source *source = (struct sertee_source *) arg;
+	
+	source->detached = 0;
+	sertee_source_watch(source, EPOLL_CTL_ADD);
+	
+	shard_notify_supervisor(shard, 'a');
+}
+
+// the detaching shard hands the source over to source->migrate_to,
+// afterwards it will ignore any pending events of the source. The
+// supervisor sends the attach command, as a shard that waits for the
+// command pipe of another shard may deadlock with it. Broadcast writes that
+// arrive in between are already handled by the new shard.
+static void shard_detach_source(struct sertee_shard *shard, void *arg) {
+	struct sertee_source *source = (struct sertee_source *) arg;
+	
+	EVENT(shard, EV_MIGRATE, source->id, shard->id, source->migrate_to->id, source->rate);
+	
+	sertee_source_watch(source, EPOLL_CTL_DEL);
+	source->detached = 1;
+	__atomic_store_n(&source->shard, source->migrate_to, __ATOMIC_RELEASE);
+	
+	shard_notify_supervisor(shard, 'd');
+}
+
+#define MAX_EVENTS 5
+
+void sertee_loop(struct sertee_shard *shard) {
+	int res = 0;
+	struct fuse_buf fbuf = {.mem = NULL, };
+	struct epoll_event events[MAX_EVENTS];
+	struct sertee_dev *sertee_dev;
+	struct sertee_source *source;
+	struct fuse_session *fsess;
+	
+	int event_count, i, stop, timeout;
+	struct timespec now;
+	
+	stop = 0;
+	while (!stop && !shard->stop) {
+		// do not keep captured data for too long if nothing happens
+		timeout = shard->capture_batch && shard->capture_batch->len ? CAPTURE_FLUSH_INTERVAL : 30000;
+		
+		// commands for other shards wait for space in their pipes
+		if (shard->tx_retry_head || shard->op_retry_head)
+			timeout = 1;
+		
+		event_count = epoll_wait(shard->epoll_fd, events, MAX_EVENTS, timeout);
+		if (event_count < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		
+		TRACE(loop, shard->id, event_count);
+		
+		if (shard->tx_retry_head || shard->op_retry_head)
+			shard_retry_forward(shard);
+		
+		if (shard->capture_batch && shard->capture_batch->len) {
+			clock_gettime(CLOCK_REALTIME, &now);
+			if ((uint64_t) now.tv_sec * 1000000000 + now.tv_nsec - shard->capture_batch->first_ts >= CAPTURE_FLUSH_INTERVAL * 1000000ULL)
+				capture_flush(shard);
+		}
+		
+		for (i=0; i < event_count; i++) {
+			switch (*(enum sertee_obj_type *) events[i].data.ptr) {
+				case SERTEE_OBJ_SHARD:
+					shard_process_cmds(shard);
+					continue;
+				case SERTEE_OBJ_SOURCE:
+					source = (struct sertee_source *) events[i].data.ptr;
+					
+					// source has been moved to another shard in this iteration
+					if (source->shard != shard)
+						continue;
+					
+					if (events[i].events & EPOLLOUT)
+						source_write(source);
+					if (events[i].events & ~EPOLLOUT)
+						source_read(source);
+					// a terminal reports a hangup with EPOLLHUP and read() returns
+					// 0 afterwards, the remaining data was read above
+					if (events[i].events & (EPOLLHUP | EPOLLERR) && source->source_fd != -1)
+						source_disconnect(source);
+					continue;
+				case SERTEE_OBJ_SOURCE_TIMER:
+					source = container_of(events[i].data.ptr, struct sertee_source, timer_type);
+					
+					if (source->shard != shard)
+						continue;
+					
+					source_run_timers(source);
+					continue;
+				case SERTEE_OBJ_DEV:
+					sertee_dev = (struct sertee_dev *) events[i].data.ptr;
+					
+					if (sertee_dev->source->shard != shard)
+						continue;
+					
+					fsess = sertee_dev->fsess;
+					break;
+				case SERTEE_OBJ_BROADCAST:
+					fsess = ((struct sertee_broadcast *) events[i].data.ptr)->fsess;
+					break;
+				case SERTEE_OBJ_TSDEV:
+					if (((struct sertee_tsdev *) events[i].data.ptr)->source->shard != shard)
+						continue;
+					
+					fsess = ((struct sertee_tsdev *) events[i].data.ptr)->fsess;
+					break;
+				case SERTEE_OBJ_MONITOR:
+					if (((struct sertee_monitor *) events[i].data.ptr)->source->shard != shard)
+						continue;
+					
+					fsess = ((struct sertee_monitor *) events[i].data.ptr)->fsess;
+					break;
+				case SERTEE_OBJ_METRICS:
+					metrics_accept((struct sertee_metrics *) events[i].data.ptr);
+					continue;
+				case SERTEE_OBJ_METRICS_CONN:
+					metrics_conn_event((struct metrics_conn *) events[i].data.ptr, events[i].events);
+					continue;
+				case SERTEE_OBJ_STATS:
+					fsess = ((struct sertee_statsdev *) events[i].data.ptr)->fsess;
+					break;
+				case SERTEE_OBJ_ALARM:
+					fsess = ((struct sertee_alarmdev *) events[i].data.ptr)->fsess;
+					break;
+				default:
+					continue;
+			}
+			
+			// all sessions of a shard share the same buffer
+			res = fuse_session_receive_buf(fsess, &fbuf);
+			
+			if (res == -EINTR)
+				continue;
+			if (res <= 0) {
+				stop = 1;
+				break;
+			}
+			
+			fuse_session_process_buf(fsess, &fbuf);
+			
+			if (fuse_session_exited(fsess)) {
+				stop = 1;
+				break;
+			}
+		}
+	}
+	
+	capture_flush(shard);
+	
+	free(fbuf.mem);
+}
+
+static void *sertee_shard_thread(void *arg) {
+	struct sertee_shard *shard = (struct sertee_shard *) arg;
+	char c = 'x';
+	
+	sertee_loop(shard);
+	
+	// tell the supervisor that we stopped so it can stop the other shards
+	if (write(shard->sertee->supervisor_fds[1], &c, 1) != 1)
+		fprintf(stderr, "notifying supervisor failed: %s\n", strerror(errno));
+	
+	return 0;
+}
+
+static int sertee_shard_init(struct sertee *sertee, struct sertee_shard *shard, unsigned int id) {
+	shard->type = SERTEE_OBJ_SHARD;
+	shard->sertee = sertee;
+	shard->id = id;
+	shard->cpu = -1;
+	
+	shard->epoll_fd = epoll_create1(0);
+	if (shard->epoll_fd == -1) {
+		fprintf(stderr, "epoll_create1 failed\n");
+		return 1;
+	}
+	
+	// a sender that has to wait polls the writing end, see shard_send_cmd()
+	if (pipe2(shard->cmd_fds, O_NONBLOCK | O_CLOEXEC)) {
+		fprintf(stderr, "pipe2 failed: %s\n", strerror(errno));
+		return 1;
+	}
+	
+	shard->cmd_eevent.events = EPOLLIN;
+	shard->cmd_eevent.data.ptr = shard;
+	if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->cmd_fds[0], &shard->cmd_eevent)) {
+		fprintf(stderr, "epoll_ctl(shard) failed\n");
+		return 1;
+	}
+	
+	return 0;
+}
+
+// wait for a message from a shard, returns the message or 0 on timeout
+static char sertee_supervisor_wait(struct sertee *sertee, int timeout) {
+	struct pollfd pfd;
+	char c;
+	int rv;
+	
+	pfd.fd = sertee->supervisor_fds[0];
+	pfd.events = POLLIN;
+	
+	rv = poll(&pfd, 1, timeout);
+	if (rv < 0)
+		return errno == EINTR ? 0 : 'x';
+	if (rv == 0)
+		return 0;
+	
+	if (read(sertee->supervisor_fds[0], &c, 1) != 1)
+		return 'x';
+	
+	return c;
+}
+
+// wait for the message want of a shard, returns non-zero if a shard stopped
+static int sertee_supervisor_expect(struct sertee *sertee, char want) {
+	char c;
+	
+	do {
+		c = sertee_supervisor_wait(sertee, -1);
+	} while (c == 0);
+	
+	return c != want;
+}
+
+// move sources from the busiest to the least busy shard as long as this
+// reduces the difference between both. Returns non-zero if a shard stopped.
+static int sertee_rebalance(struct sertee *sertee) {
+	unsigned int i, moves;
+	uint64_t bytes, diff;
+	struct sertee_source *source, *best;
+	struct sertee_shard *max, *min;
+	
+	for (i=0; i < sertee->n_shards; i++)
+		sertee->shards[i].load = 0;
+	
+	for (i=0; i < sertee->n_sources; i++) {
+		source = sertee->sources[i];
+		
+		bytes = COUNTER_GET(source->stats.bytes_in);
+		source->rate = (bytes - source->rate_bytes) / sertee->rebalance_interval;
+		source->rate_bytes = bytes;
+		
+		source->shard->load += source->rate;
+	}
+	
+	for (moves = 0; moves < sertee->n_sources; moves++) {
+		max = min = &sertee->shards[0];
+		for (i=1; i < sertee->n_shards; i++) {
+			if (sertee->shards[i].load > max->load)
+				max = &sertee->shards[i];
+			if (sertee->shards[i].load < min->load)
+				min = &sertee->shards[i];
+		}
+		
+		diff = max->load - min->load;
+		
+		// moving a source with rate r changes the difference to |diff - 2r|,
+		// pick the source that gets closest to zero
+		best = 0;
+		for (i=0; i < sertee->n_sources; i++) {
+			source = sertee->sources[i];
+			
+			if (source->shard != max || source->shard_id >= 0 || source->rate == 0 || source->rate >= diff)
+				continue;
+			
+			if (!best || llabs((long long) diff - 2 * (long long) source->rate) < llabs((long long) diff - 2 * (long long) best->rate))
+				best = source;
+		}
+		if (!best)
+			break;
+		
+		max->load -= best->rate;
+		min->load += best->rate;
+		
+		best->migrate_to = min;
+		if (sertee_shard_call(max, shard_detach_source, best) || sertee_supervisor_expect(sertee, 'd'))
+			return 1;
+		
+		// wait until the new shard took over before we continue
+		if (sertee_shard_call(min, shard_attach_source, best) || sertee_supervisor_expect(sertee, 'a'))
+			return 1;
+	}
+	
+	return 0;
+}
+
+static void sertee_supervise(struct sertee *sertee) {
+	unsigned int i;
+	int timeout;
+	char c;
+	
+	timeout = sertee->rebalance_interval ? sertee->rebalance_interval * 1000 : -1;
+	
+	while (1) {
+		c = sertee_supervisor_wait(sertee, timeout);
+		if (c == 'x')
+			break;
+		
+		if (c == 0 && sertee->rebalance_interval && sertee_rebalance(sertee))
+			break;
+	}
+	
+	for (i=0; i < sertee->n_shards; i++)
+		sertee_shard_call(&sertee->shards[i], shard_stop, 0);
+}
+
+static int sertee_start_shards(struct sertee *sertee) {
+	unsigned int i;
+	cpu_set_t cpuset;
+	int rv;
+	
+	for (i=0; i < sertee->n_shards; i++) {
+		rv = pthread_create(&sertee->shards[i].thread, 0, sertee_shard_thread, &sertee->shards[i]);
+		if (rv) {
+			fprintf(stderr, "pthread_create failed: %s\n", strerror(rv));
+			return 1;
+		}
+		
+		if (sertee->shards[i].cpu >= 0) {
+			CPU_ZERO(&cpuset);
+			CPU_SET(sertee->shards[i].cpu, &cpuset);
+			
+			rv = pthread_setaffinity_np(sertee->shards[i].thread, sizeof(cpuset), &cpuset);
+			if (rv)
+				fprintf(stderr, "binding shard %u to cpu %d failed: %s\n", i, sertee->shards[i].cpu, strerror(rv));
+		}
+	}
+	
+	return 0;
+}
+
+// create a CUSE device and add it to the event loop of shard, userdata has to
+// start with its enum sertee_obj_type
+static struct fuse_session *sertee_lowlevel_main(int argc, char *argv[],
+								struct cuse_info *ci, const struct cuse_lowlevel_ops *llops,
+								void *userdata, struct sertee_shard *shard,
+								struct epoll_event *eevent)
+{
+	struct fuse_session *fsess;
+	int multithreaded;
+	
+	fsess = cuse_lowlevel_setup(argc, argv, ci, llops, &multithreaded, userdata);
+	if (fsess == NULL)
+		return 0;
+	
+	if (multithreaded) {
+		fprintf(stdout, "multithreading not supported\n");
+	}
+	
+	eevent->events = EPOLLIN;
+	eevent->data.ptr = userdata;
+
+	if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, fuse_session_fd(fsess), eevent)) {
+		fprintf(stderr, "epoll_ctl failed\n");
+		cuse_lowlevel_teardown(fsess);
+		return 0;
+	}
+	
+	return fsess;
+}
+
+static void sertee_source_init(struct sertee *sertee, struct sertee_source *source) {
+	memset(source, 0, sizeof(struct sertee_source));
+	
+	source->type = SERTEE_OBJ_SOURCE;
+	source->sertee = sertee;
+	source->source_fd = -1;
+	source->bufsize = DEFAULT_BUFSIZE;
+	source->shard_id = -1;
+	source->monitor_size = DEFAULT_MONITOR_SIZE;
+	source->modem_cache = DEFAULT_MODEM_CACHE;
+	source->source_vmin = -1;
+	source->source_vtime = -1;
+	source->reconnect = DEFAULT_RECONNECT_INTERVAL;
+}
+
+// create a new source group with the options of template or defaults
+static struct sertee_source *sertee_source_new(struct sertee *sertee, struct sertee_source *template) {
+	struct sertee_source *source;
+	
+	source = (struct sertee_source *) sertee_zalloc(sizeof(struct sertee_source));
+	if (!source)
+		return 0;
+	
+	if (template)
+		*source = *template;
+	else
+		sertee_source_init(sertee, source);
+	
+	return source;
+}
+
+// free a source group that was not added, including its option strings
+static void sertee_source_free(struct sertee_source *source) {
+	free(source->dev_names);
+	free(source->source_name);
+	free(source->monitor_name);
+	free(source->timestamps);
+	free(source->framing);
+	free(source->flow);
+	free(source);
+}
+
+static int sertee_add_source(struct sertee *sertee, struct sertee_source *source) {
+	struct termios t;
+	
+	if (!source->dev_names) {
+		fprintf(stderr, "error, device names required\n");
+		return 1;
+	}
+	if (!source->source_name) {
+		fprintf(stderr, "error, source name required\n");
+		return 1;
+	}
+	if (source->bufsize == 0) {
+		fprintf(stderr, "error, invalid buffer size for source \"%s\"\n", source->source_name);
+		return 1;
+	}
+	if (source->timestamps && strcmp(source->timestamps, "bin") && strcmp(source->timestamps, "json")) {
+		fprintf(stderr, "error, invalid timestamp format \"%s\"\n", source->timestamps);
+		return 1;
+	}
+	if (source->source_vmin > 255 || source->source_vtime > 255) {
+		fprintf(stderr, "error, source VMIN and VTIME must be less than 256\n");
+		return 1;
+	}
+	
+	// check the line settings before we start
+	memset(&t, 0, sizeof(t));
+	if (source_build_termios(source, &t))
+		return 1;
+	
+	source->id = sertee->n_sources;
+	
+	if (!strncmp(source->source_name, "gen:", 4) && gen_parse(source))
+		return 1;
+	
+	sertee->n_sources += 1;
+	sertee->sources = (struct sertee_source **) realloc(sertee->sources, sizeof(void *) * sertee->n_sources);
+	sertee->sources[sertee->n_sources-1] = source;
+	
+	return 0;
+}
+
+// keep arguments we do not know, they are passed to cuse later
+static int sertee_source_process_arg(void *data, const char *arg, int key, struct fuse_args *outargs) {
+	return 1;
+}
+
+static int sertee_read_config_broadcast(struct sertee *sertee, struct fuse_args *largs, const char *path, unsigned int lineno) {
+	struct sertee_broadcast *broadcast;
+	int rv;
+	
+	broadcast = (struct sertee_broadcast *) calloc(1, sizeof(struct sertee_broadcast));
+	if (!broadcast)
+		return 1;
+	
+	broadcast->type = SERTEE_OBJ_BROADCAST;
+	broadcast->sertee = sertee;
+	
+	rv = 0;
+	if (fuse_opt_parse(largs, broadcast, sertee_broadcast_opts, sertee_source_process_arg)) {
+		fprintf(stderr, "%s:%u: parsing options failed\n", path, lineno);
+		rv = 1;
+	} else
+	if (largs->argc > 1) {
+		fprintf(stderr, "%s:%u: unknown option \"%s\"\n", path, lineno, largs->argv[1]);
+		rv = 1;
+	}
+	
+	// fuse_opt may have set some of the strings before it failed
+	if (rv) {
+		free(broadcast->dev_name);
+		free(broadcast->targets);
+		free(broadcast);
+		return rv;
+	}
+	
+	sertee->n_broadcasts += 1;
+	sertee->broadcasts = (struct sertee_broadcast **) realloc(sertee->broadcasts, sizeof(void *) * sertee->n_broadcasts);
+	sertee->broadcasts[sertee->n_broadcasts-1] = broadcast;
+	
+	return 0;
+}
+
+static int sertee_read_config_source(struct sertee *sertee, struct fuse_args *largs, const char *path, unsigned int lineno) {
+	struct sertee_source *source;
+	int rv;
+	
+	source = sertee_source_new(sertee, 0);
+	if (!source)
+		return 1;
+	
+	rv = 0;
+	if (fuse_opt_parse(largs, source, sertee_source_opts, sertee_source_process_arg)) {
+		fprintf(stderr, "%s:%u: parsing options failed\n", path, lineno);
+		rv = 1;
+	} else
+	if (largs->argc > 1) {
+		fprintf(stderr, "%s:%u: unknown option \"%s\"\n", path, lineno, largs->argv[1]);
+		rv = 1;
+	} else
+	if (sertee_add_source(sertee, source)) {
+		fprintf(stderr, "%s:%u: invalid source group\n", path, lineno);
+		rv = 1;
+	}
+	
+	// the source only belongs to sertee once it was added
+	if (rv)
+		sertee_source_free(source);
+	
+	return rv;
+}
+
+static int sertee_read_config(struct sertee *sertee, const char *path) {
+	FILE *f;
+	char *line, *it, *saveit, *opt;
+	size_t line_size;
+	unsigned int lineno;
+	struct fuse_args largs;
+	int rv;
+	
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "opening config \"%s\" failed: %s\n", path, strerror(errno));
+		return 1;
+	}
+	
+	rv = 0;
+	line = 0;
+	line_size = 0;
+	lineno = 0;
+	while (rv == 0 && getline(&line, &line_size, f) >= 0) {
+		lineno += 1;
+		
+		it = strchr(line, '#');
+		if (it)
+			*it = 0;
+		
+		it = strtok_r(line, " \t\r\n", &saveit);
+		if (!it)
+			continue;
+		
+		// turn "key=value" into "--key=value" and let fuse_opt do the rest
+		largs = (struct fuse_args) FUSE_ARGS_INIT(0, NULL);
+		fuse_opt_add_arg(&largs, "sertee");
+		while (it != NULL) {
+			if (asprintf(&opt, "--%s", it) < 0) {
+				rv = 1;
+				break;
+			}
+			fuse_opt_add_arg(&largs, opt);
+			free(opt);
+			
+			it = strtok_r(NULL, " \t\r\n", &saveit);
+		}
+		
+		if (rv == 0) {
+			if (largs.argc > 1 && !strncmp(largs.argv[1], "--broadcast=", 12))
+				rv = sertee_read_config_broadcast(sertee, &largs, path, lineno);
+			else
+				rv = sertee_read_config_source(sertee, &largs, path, lineno);
+		}
+		
+		fuse_opt_free_args(&largs);
+	}
+	
+	free(line);
+	fclose(f);
+	
+	return rv;
+}
+
+// find the sources of every broadcast device. The broadcast devices are
+// spread over the shards, their writes are forwarded to the shards of the
+// sources.
+static int sertee_resolve_broadcasts(struct sertee *sertee) {
+	struct sertee_broadcast *broadcast;
+	unsigned int i, j;
+	char *it, *saveit;
+	
+	for (i=0; i < sertee->n_broadcasts; i++) {
+		broadcast = sertee->broadcasts[i];
+		
+		if (broadcast->targets) {
+			it = strtok_r(broadcast->targets, ",", &saveit);
+			while (it != NULL) {
+				for (j=0; j < sertee->n_sources; j++) {
+					if (!strcmp(sertee->sources[j]->source_name, it))
+						break;
+				}
+				if (j == sertee->n_sources) {
+					fprintf(stderr, "error, unknown source \"%s\" for broadcast \"%s\"\n", it, broadcast->dev_name);
+					return 1;
+				}
+				
+				broadcast->n_sources += 1;
+				broadcast->sources = (struct sertee_source **) realloc(broadcast->sources, sizeof(void *) * broadcast->n_sources);
+				broadcast->sources[broadcast->n_sources-1] = sertee->sources[j];
+				
+				it = strtok_r(NULL, ",", &saveit);
+			}
+		} else {
+			broadcast->n_sources = sertee->n_sources;
+			broadcast->sources = (struct sertee_source **) malloc(sizeof(void *) * broadcast->n_sources);
+			memcpy(broadcast->sources, sertee->sources, sizeof(void *) * broadcast->n_sources);
+		}
+		
+		if (broadcast->n_sources == 0) {
+			fprintf(stderr, "error, broadcast \"%s\" without sources\n", broadcast->dev_name);
+			return 1;
+		}
+		
+		broadcast->shard = &sertee->shards[i % sertee->n_shards];
+	}
+	
+	return 0;
+}
+
+static int sertee_broadcast_setup(struct sertee *sertee, struct sertee_broadcast *broadcast) {
+	int rv;
+	
+	if (!broadcast->dev_name) {
+		fprintf(stderr, "error, broadcast device name required\n");
+		return 1;
+	}
+	
+	rv = asprintf(&broadcast->name, "DEVNAME=%s", broadcast->dev_name);
+	if (rv < 0) {
+		fprintf(stderr, "asprintf() failed: %d\n", rv);
+		return rv;
+	}
+	
+	broadcast->dev_info_argv[0] = broadcast->name;
+	
+	broadcast->ci.dev_info_argc = 1;
+	broadcast->ci.dev_info_argv = &broadcast->dev_info_argv[0];
+	
+	broadcast->fsess = sertee_lowlevel_main(sertee->args->argc, sertee->args->argv,
+				&broadcast->ci, &broadcast_llops, broadcast, broadcast->shard, &broadcast->eevent);
+	if (!broadcast->fsess)
+		return 1;
+	
+	return 0;
+}
+
+// create the shards and distribute the sources, at first just by their number
+// as we do not know their byte rates yet
+static int sertee_setup_shards(struct sertee *sertee) {
+	unsigned int i, j, n_cpus;
+	unsigned int *n_assigned;
+	struct sertee_shard *shard;
+	char *it, *saveit;
+	
+	n_cpus = 0;
+	if (sertee->cpus) {
+		for (it = sertee->cpus; *it; it++) {
+			if (*it == ',')
+				n_cpus += 1;
+		}
+		n_cpus += 1;
+	}
+	
+	if (sertee->n_shards == 0)
+		sertee->n_shards = n_cpus ? n_cpus : 1;
+	
+	sertee->shards = (struct sertee_shard *) sertee_zalloc(sertee->n_shards * sizeof(struct sertee_shard));
+	n_assigned = (unsigned int *) calloc(sertee->n_shards, sizeof(unsigned int));
+	if (!sertee->shards || !n_assigned) {
+		fprintf(stderr, "allocating shards failed\n");
+		return 1;
+	}
+	
+	for (i=0; i < sertee->n_shards; i++) {
+		if (sertee_shard_init(sertee, &sertee->shards[i], i))
+			return 1;
+	}
+	
+	if (sertee->cpus) {
+		i = 0;
+		it = strtok_r(sertee->cpus, ",", &saveit);
+		while (it != NULL) {
+			for (j = i; j < sertee->n_shards; j += n_cpus)
+				sertee->shards[j].cpu = atoi(it);
+			
+			i += 1;
+			it = strtok_r(NULL, ",", &saveit);
+		}
+	}
+	
+	if (pipe2(sertee->supervisor_fds, O_CLOEXEC)) {
+		fprintf(stderr, "pipe2 failed: %s\n", strerror(errno));
+		return 1;
+	}
+	
+	if (sertee_resolve_broadcasts(sertee))
+		return 1;
+	
+	for (i=0; i < sertee->n_sources; i++) {
+		if (sertee->sources[i]->shard_id < 0)
+			continue;
+		
+		if (sertee->sources[i]->shard_id >= sertee->n_shards) {
+			fprintf(stderr, "error, source \"%s\" uses invalid shard %d\n", sertee->sources[i]->source_name, sertee->sources[i]->shard_id);
+			return 1;
+		}
+		
+		sertee->sources[i]->shard = &sertee->shards[sertee->sources[i]->shard_id];
+		n_assigned[sertee->sources[i]->shard_id] += 1;
+	}
+	
+	for (i=0; i < sertee->n_sources; i++) {
+		if (sertee->sources[i]->shard)
+			continue;
+		
+		shard = &sertee->shards[0];
+		for (j=1; j < sertee->n_shards; j++) {
+			if (n_assigned[j] < n_assigned[shard->id])
+				shard = &sertee->shards[j];
+		}
+		
+		sertee->sources[i]->shard = shard;
+		n_assigned[shard->id] += 1;
+	}
+	
+	free(n_assigned);
+	
+	return 0;
+}
+
+static int sertee_monitor_setup(struct sertee *sertee, struct sertee_source *source) {
+	struct sertee_monitor *monitor;
+	int rv;
+	
+	if (source->monitor_size < 4 * sizeof(struct monitor_rec)) {
+		fprintf(stderr, "error, monitor buffer of \"%s\" too small\n", source->source_name);
+		return 1;
+	}
+	
+	monitor = (struct sertee_monitor *) calloc(1, sizeof(struct sertee_monitor));
+	if (!monitor)
+		return 1;
+	
+	monitor->type = SERTEE_OBJ_MONITOR;
+	monitor->source = source;
+	monitor->size = MONITOR_ALIGN(source->monitor_size);
+	monitor->buf = malloc(monitor->size);
+	if (!monitor->buf) {
+		fprintf(stderr, "allocating monitor buffer for \"%s\" failed\n", source->source_name);
+		return 1;
+	}
+	
+	rv = asprintf(&monitor->name, "DEVNAME=%s", source->monitor_name);
+	if (rv < 0) {
+		fprintf(stderr, "asprintf() failed: %d\n", rv);
+		return rv;
+	}
+	
+	monitor->dev_info_argv[0] = monitor->name;
+	
+	monitor->ci.dev_info_argc = 1;
+	monitor->ci.dev_info_argv = &monitor->dev_info_argv[0];
+	
+	monitor->fsess = sertee_lowlevel_main(sertee->args->argc, sertee->args->argv,
+				&monitor->ci, &monitor_llops, monitor, source->shard, &monitor->eevent);
+	if (!monitor->fsess)
+		return 1;
+	
+	// only record data once the device exists
+	source->monitor = monitor;
+	
+	return 0;
+}
+
+static int sertee_tsdev_setup(struct sertee *sertee, struct sertee_dev *sertee_dev) {
+	struct sertee_tsdev *tsdev;
+	int rv;
+	
+	tsdev = (struct sertee_tsdev *) calloc(1, sizeof(struct sertee_tsdev));
+	if (!tsdev)
+		return 1;
+	
+	tsdev->type = SERTEE_OBJ_TSDEV;
+	tsdev->source = sertee_dev->source;
+	tsdev->json = !strcmp(sertee_dev->source->timestamps, "json");
+	
+	rv = asprintf(&tsdev->name, "%s.ts", sertee_dev->name);
+	if (rv < 0) {
+		fprintf(stderr, "asprintf() failed: %d\n", rv);
+		return rv;
+	}
+	
+	tsdev->dev_info_argv[0] = tsdev->name;
+	
+	tsdev->ci.dev_info_argc = 1;
+	tsdev->ci.dev_info_argv = &tsdev->dev_info_argv[0];
+	
+	tsdev->fsess = sertee_lowlevel_main(sertee->args->argc, sertee->args->argv,
+				&tsdev->ci, &tsdev_llops, tsdev, tsdev->source->shard, &tsdev->eevent);
+	if (!tsdev->fsess)
+		return 1;
+	
+	sertee_dev->tsdev = tsdev;
+	
+	return 0;
+}
+
+// the stats device is always handled by the first shard
+static int sertee_stats_setup(struct sertee *sertee) {
+	struct sertee_statsdev *statsdev;
+	int rv;
+	
+	statsdev = (struct sertee_statsdev *) calloc(1, sizeof(struct sertee_statsdev));
+	if (!statsdev)
+		return 1;
+	
+	statsdev->type = SERTEE_OBJ_STATS;
+	statsdev->sertee = sertee;
+	
+	rv = asprintf(&statsdev->name, "DEVNAME=%s", sertee->stats_name);
+	if (rv < 0) {
+		fprintf(stderr, "asprintf() failed: %d\n", rv);
+		return rv;
+	}
+	
+	statsdev->dev_info_argv[0] = statsdev->name;
+	
+	statsdev->ci.dev_info_argc = 1;
+	statsdev->ci.dev_info_argv = &statsdev->dev_info_argv[0];
+	
+	statsdev->fsess = sertee_lowlevel_main(sertee->args->argc, sertee->args->argv,
+				&statsdev->ci, &stats_llops, statsdev, &sertee->shards[0], &statsdev->eevent);
+	if (!statsdev->fsess)
+		return 1;
+	
+	sertee->statsdev = statsdev;
+	
+	return 0;
+}
+
+// the alarm device is always handled by the first shard which also runs the
+// alarm command
+static int sertee_alarm_setup(struct sertee *sertee) {
+	struct sertee_alarmdev *alarmdev;
+	struct sigaction sa;
+	int rv;
+	
+	if (sertee->alarm_exec) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = SIG_IGN;
+		sa.sa_flags = SA_NOCLDWAIT;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(SIGCHLD, &sa, 0)) {
+			fprintf(stderr, "sigaction failed: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+	
+	if (!sertee->alarm_name)
+		return 0;
+	
+	alarmdev = (struct sertee_alarmdev *) calloc(1, sizeof(struct sertee_alarmdev));
+	if (!alarmdev)
+		return 1;
+	
+	alarmdev->type = SERTEE_OBJ_ALARM;
+	alarmdev->sertee = sertee;
+	
+	rv = asprintf(&alarmdev->name, "DEVNAME=%s", sertee->alarm_name);
+	if (rv < 0) {
+		fprintf(stderr, "asprintf() failed: %d\n", rv);
+		return rv;
+	}
+	
+	alarmdev->dev_info_argv[0] = alarmdev->name;
+	
+	alarmdev->ci.dev_info_argc = 1;
+	alarmdev->ci.dev_info_argv = &alarmdev->dev_info_argv[0];
+	
+	alarmdev->fsess = sertee_lowlevel_main(sertee->args->argc, sertee->args->argv,
+				&alarmdev->ci, &alarm_llops, alarmdev, &sertee->shards[0], &alarmdev->eevent);
+	if (!alarmdev->fsess)
+		return 1;
+	
+	sertee->alarmdev = alarmdev;
+	
+	return 0;
+}
+
+// listen on unix:PATH or on tcp:PORT of the loopback interface
+static int sertee_metrics_setup(struct sertee *sertee) {
+	struct sertee_metrics *metrics;
+	struct sockaddr_un sun;
+	struct sockaddr_in sin;
+	struct stat st;
+	unsigned int i;
+	char *end;
+	long port;
+	int one = 1;
+	
+	metrics = (struct sertee_metrics *) calloc(1, sizeof(struct sertee_metrics));
+	if (!metrics)
+		return 1;
+	
+	metrics->type = SERTEE_OBJ_METRICS;
+	metrics->sertee = sertee;
+	metrics->shard = &sertee->shards[0];
+	metrics->out_size = metrics_max_size(sertee);
+	
+	for (i=0; i < METRICS_MAX_CONNS; i++) {
+		metrics->conns[i].type = SERTEE_OBJ_METRICS_CONN;
+		metrics->conns[i].metrics = metrics;
+		metrics->conns[i].fd = -1;
+		metrics->conns[i].eevent.data.ptr = &metrics->conns[i];
+		metrics->conns[i].out = malloc(metrics->out_size);
+		if (!metrics->conns[i].out)
+			return 1;
+	}
+	
+	if (!strncmp(sertee->metrics_addr, "unix:", 5)) {
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		if (strlen(sertee->metrics_addr + 5) >= sizeof(sun.sun_path)) {
+			fprintf(stderr, "error, metrics socket path too long\n");
+			return 1;
+		}
+		strcpy(sun.sun_path, sertee->metrics_addr + 5);
+		
+		// remove a stale socket of a previous run
+		if (stat(sun.sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+			unlink(sun.sun_path);
+		
+		metrics->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (metrics->fd < 0 || bind(metrics->fd, (struct sockaddr *) &sun, sizeof(sun))) {
+			fprintf(stderr, "binding metrics socket \"%s\" failed: %s\n", sun.sun_path, strerror(errno));
+			return 1;
+		}
+	} else
+	if (!strncmp(sertee->metrics_addr, "tcp:", 4)) {
+		port = strtol(sertee->metrics_addr + 4, &end, 10);
+		if (*end || port <= 0 || port > 65535) {
+			fprintf(stderr, "error, invalid metrics port \"%s\"\n", sertee->metrics_addr + 4);
+			return 1;
+		}
+		
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(port);
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		
+		metrics->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (metrics->fd >= 0)
+			setsockopt(metrics->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (metrics->fd < 0 || bind(metrics->fd, (struct sockaddr *) &sin, sizeof(sin))) {
+			fprintf(stderr, "binding metrics port %ld failed: %s\n", port, strerror(errno));
+			return 1;
+		}
+	} else {
+		fprintf(stderr, "error, invalid metrics address \"%s\"\n", sertee->metrics_addr);
+		return 1;
+	}
+	
+	if (listen(metrics->fd, METRICS_MAX_CONNS)) {
+		fprintf(stderr, "listen() failed: %s\n", strerror(errno));
+		return 1;
+	}
+	
+	metrics->eevent.events = EPOLLIN;
+	metrics->eevent.data.ptr = metrics;
+	if (epoll_ctl(metrics->shard->epoll_fd, EPOLL_CTL_ADD, metrics->fd, &metrics->eevent)) {
+		fprintf(stderr, "epoll_ctl(metrics) failed: %s\n", strerror(errno));
+		return 1;
+	}
+	
+	sertee->metrics = metrics;
+	
+	return 0;
+}
+
+static size_t events_rings_offset(unsigned int n_names) {
+	return (sizeof(struct event_log_hdr) + (size_t) n_names * EVENTS_NAME_SIZE + CACHE_LINE_SIZE - 1) & ~((size_t) CACHE_LINE_SIZE - 1);
+}
+
+static size_t events_ring_size(unsigned int n_records) {
+	return sizeof(struct event_ring) + (((size_t) n_records * sizeof(struct sertee_event) + CACHE_LINE_SIZE - 1) & ~((size_t) CACHE_LINE_SIZE - 1));
+}
+
+static void sertee_events_toggle(int sig) {
+	sertee_events_on = !sertee_events_on;
+}
+
+static void events_set_name(char *names, unsigned int id, const char *name) {
+	strncpy(names + id * EVENTS_NAME_SIZE, name, EVENTS_NAME_SIZE - 1);
+}
+
+// map the event log file with a ring per shard and write the names of all
+// sources and devices into it. Called once all objects exist.
+static int sertee_events_setup(struct sertee *sertee) {
+	struct event_log_hdr *hdr;
+	struct sertee_source *source;
+	struct sigaction sa;
+	size_t rings_offset, ring_size;
+	unsigned int i, j, n_names, n_records;
+	char *names;
+	int fd;
+	
+	if (sertee->events_size == 0 || sertee->events_size > (1U << 31)) {
+		fprintf(stderr, "error, invalid number of events %u\n", sertee->events_size);
+		return 1;
+	}
+	
+	// rings are indexed with a mask
+	n_records = 1;
+	while (n_records < sertee->events_size)
+		n_records <<= 1;
+	
+	n_names = sertee->n_sources + sertee->n_broadcasts;
+	for (i=0; i < sertee->n_sources; i++)
+		n_names += sertee->sources[i]->n_devs;
+	
+	rings_offset = events_rings_offset(n_names);
+	ring_size = events_ring_size(n_records);
+	sertee->events_map_size = rings_offset + sertee->n_shards * ring_size;
+	
+	fd = open(sertee->events, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "opening event log \"%s\" failed: %s\n", sertee->events, strerror(errno));
+		return 1;
+	}
+	if (ftruncate(fd, sertee->events_map_size)) {
+		fprintf(stderr, "resizing event log \"%s\" failed: %s\n", sertee->events, strerror(errno));
+		close(fd);
+		return 1;
+	}
+	
+	sertee->events_map = mmap(0, sertee->events_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (sertee->events_map == MAP_FAILED) {
+		sertee->events_map = 0;
+		fprintf(stderr, "mapping event log \"%s\" failed: %s\n", sertee->events, strerror(errno));
+		return 1;
+	}
+	
+	// allocate all pages now instead of faulting them in on the hot path
+	memset(sertee->events_map, 0, sertee->events_map_size);
+	
+	hdr = (struct event_log_hdr *) sertee->events_map;
+	memcpy(hdr->magic, EVENTS_MAGIC, sizeof(hdr->magic));
+	hdr->n_shards = sertee->n_shards;
+	hdr->n_records = n_records;
+	hdr->n_names = n_names;
+	
+	// sources first, then devices and broadcast devices
+	names = (char *) (hdr + 1);
+	n_names = sertee->n_sources;
+	for (i=0; i < sertee->n_sources; i++) {
+		source = sertee->sources[i];
+		
+		events_set_name(names, source->id, source->source_name);
+		for (j=0; j < source->n_devs; j++) {
+			source->devs[j]->id = n_names++;
+			events_set_name(names, source->devs[j]->id, source->devs[j]->dev_name);
+		}
+	}
+	for (i=0; i < sertee->n_broadcasts; i++) {
+		sertee->broadcasts[i]->id = n_names++;
+		events_set_name(names, sertee->broadcasts[i]->id, sertee->broadcasts[i]->dev_name);
 	}
 	
-	// workaround to call send_ok() as client would hang without it
-	fuse_reply_buf(req, 0, 0);
-}
-
-static char *get_data_end(struct sertee_dev *sertee_dev) {
-	char *end;
+	for (i=0; i < sertee->n_shards; i++) {
+		sertee->shards[i].events = (struct event_ring *) ((char *) sertee->events_map + rings_offset + i * ring_size);
+		sertee->shards[i].events_mask = n_records - 1;
+	}
 	
-	if (sertee_dev->pos < sertee_dev->sertee->pos) {
-		end = sertee_dev->sertee->pos;
-	} else
-	if (sertee_dev->pos == sertee_dev->sertee->pos && sertee_dev->sertee->round == sertee_dev->round) {
-		end = sertee_dev->sertee->buf;
-	} else {
-		end = sertee_dev->sertee->buf + sertee_dev->sertee->bufsize;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sertee_events_toggle;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGUSR1, &sa, 0)) {
+		fprintf(stderr, "sigaction failed: %s\n", strerror(errno));
+		return 1;
 	}
 	
-	return end;
+	sertee_events_on = sertee->events_on;
+	
+	return 0;
 }
 
-static size_t get_avail_data_size(struct sertee_dev *sertee_dev) {
-	size_t size;
-	char *end;
-	
-	end = get_data_end(sertee_dev);
+struct event_desc {
+	const char *name;
+	// format of the arguments a, b and c of the event
+	const char *fmt;
+};
+
+static const struct event_desc event_descs[EV_MAX] = {
+	[EV_SOURCE_READ] = { "source_read", "len %" PRIu64 " offset %" PRIu64 " pos %" PRIu64 },
+	[EV_OVERRUN] = { "overrun", "lost %" PRIu64 },
+	[EV_NOTIFY] = { "notify", "lag %" PRIu64 },
+	[EV_DISCONNECT] = { "disconnect", "offset %" PRIu64 },
+	[EV_RECONNECT] = { "reconnect", "offset %" PRIu64 },
+	[EV_OPEN] = { "open", "pid %" PRIu64 },
+	[EV_RELEASE] = { "release", "pid %" PRIu64 },
+	[EV_READ] = { "read", "size %" PRIu64 " lag %" PRIu64 " offset %" PRIu64 },
+	[EV_READ_PARK] = { "read_park", "size %" PRIu64 " vmin %" PRIu64 " vtime %" PRIu64 },
+	[EV_WRITE] = { "write", "size %" PRIu64 " pid %" PRIu64 },
+	[EV_WRITE_DONE] = { "write_done", "done %" PRIu64 "/%" PRIu64 " error %" PRIu64 },
+	[EV_IOCTL] = { "ioctl", "cmd 0x%" PRIx64 },
+	[EV_POLL] = { "poll", "lag %" PRIu64 " revents 0x%" PRIx64 " handle %" PRIu64 },
+	[EV_BROADCAST] = { "broadcast", "size %" PRIu64 " pid %" PRIu64 },
+	[EV_MIGRATE] = { "migrate", "from %" PRIu64 " to %" PRIu64 " rate %" PRIu64 },
+	[EV_THROTTLE_READ] = { "throttle_read", "pid %" PRIu64 " wait %" PRIu64 " size %" PRIu64 },
+	[EV_THROTTLE_WRITE] = { "throttle_write", "pid %" PRIu64 " size %" PRIu64 },
+	[EV_RESIZE] = { "resize", "from %" PRIu64 " to %" PRIu64 },
+	[EV_ALARM] = { "alarm", "kind %" PRIu64 " active %" PRIu64 " value %" PRIu64 },
+};
+
+// an event of the log and where it came from
+struct decoded_event {
+	struct sertee_event ev;
+	unsigned int shard;
+	uint64_t seq;
+};
+
+static int decoded_event_cmp(const void *a, const void *b) {
+	const struct decoded_event *x = (const struct decoded_event *) a;
+	const struct decoded_event *y = (const struct decoded_event *) b;
 	
-	if (sertee_dev->pos >= end) {
-		size = 0;
-	} else {
-		size = end - sertee_dev->pos;
-	}
+	if (x->ev.ts != y->ev.ts)
+		return x->ev.ts < y->ev.ts ? -1 : 1;
+	if (x->shard != y->shard)
+		return x->shard < y->shard ? -1 : 1;
 	
-	return size;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
 }
 
-static void sertee_read(fuse_req_t req, size_t size, off_t off,
-						 struct fuse_file_info *fi)
-{
-	struct sertee_dev *sertee_dev = (struct sertee_dev *) fuse_req_userdata(req);
-	char *end;
-	size_t available;
+// print the events of all shards in the order they happened. The file is read
+// at once, hence it can be decoded while sertee is running.
+static int sertee_decode_events(const char *path) {
+	struct event_log_hdr hdr;
+	struct event_ring *ring;
+	struct sertee_event *recs;
+	struct decoded_event *events;
+	const struct event_desc *desc;
+	const char *name;
+	char *buf, *names;
+	size_t len, n_events, ring_size, k;
+	uint64_t head, seq;
+	unsigned int i;
+	FILE *f;
 	
-	DBG("READ: %s off %zu size %zu rnd %u rnd_dev %u |", sertee_dev->name, off, size, sertee_dev->sertee->round, sertee_dev->round);
-	
-	end = get_data_end(sertee_dev);
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "opening event log \"%s\" failed: %s\n", path, strerror(errno));
+		return 1;
+	}
 	
-	available = get_avail_data_size(sertee_dev);
-	if (off > available) {
-		size = 0;
-	} else {
-		if (off + size > available)
-			size = available - off;
+	buf = 0;
+	len = 0;
+	if (fseek(f, 0, SEEK_END) == 0) {
+		len = ftell(f);
+		rewind(f);
+		buf = malloc(len ? len : 1);
 	}
+	if (!buf || fread(buf, 1, len, f) != len) {
+		fprintf(stderr, "reading event log \"%s\" failed\n", path);
+		fclose(f);
+		free(buf);
+		return 1;
+	}
+	fclose(f);
 	
-	DBG("%zu %zu %zu | %zd\n", off, size, available, sertee_dev->pos - sertee_dev->sertee->buf);
+	if (len >= sizeof(hdr))
+		memcpy(&hdr, buf, sizeof(hdr));
+	if (len < sizeof(hdr) || memcmp(hdr.magic, EVENTS_MAGIC, sizeof(hdr.magic)) ||
+		hdr.n_records == 0 || (hdr.n_records & (hdr.n_records - 1)) ||
+		events_rings_offset(hdr.n_names) + hdr.n_shards * events_ring_size(hdr.n_records) > len)
+	{
+		fprintf(stderr, "\"%s\" is not an event log\n", path);
+		free(buf);
+		return 1;
+	}
 	
-	fuse_reply_buf(req, sertee_dev->pos + off, size);
+	names = buf + sizeof(hdr);
+	ring_size = events_ring_size(hdr.n_records);
 	
-	sertee_dev->pos += size;
-	if (sertee_dev->pos == sertee_dev->sertee->buf + sertee_dev->sertee->bufsize) {
-		sertee_dev->pos = sertee_dev->sertee->buf;
-		sertee_dev->round += 1;
+	events = (struct decoded_event *) malloc(sizeof(struct decoded_event) * hdr.n_shards * hdr.n_records + 1);
+	if (!events) {
+		free(buf);
+		return 1;
 	}
-}
-
-static void sertee_write(fuse_req_t req, const char *buf, size_t size,
-						  off_t off, struct fuse_file_info *fi)
-{
-	struct sertee_dev *sertee_dev = (struct sertee_dev *) fuse_req_userdata(req);
-	ssize_t srv;
 	
-	DBG("WRITE: %s ", sertee_dev->name);
-	
-	srv = write(sertee_dev->sertee->source_fd, buf, size);
+	n_events = 0;
+	for (i=0; i < hdr.n_shards; i++) {
+		ring = (struct event_ring *) (buf + events_rings_offset(hdr.n_names) + i * ring_size);
+		recs = (struct sertee_event *) (ring + 1);
+		
+		head = ring->head;
+		for (seq = head > hdr.n_records ? head - hdr.n_records : 0; seq < head; seq++) {
+			events[n_events].ev = recs[seq & (hdr.n_records - 1)];
+			events[n_events].shard = i;
+			events[n_events].seq = seq;
+			n_events += 1;
+		}
+	}
 	
-	DBG("%zu -> %zd\n", size, srv);
+	qsort(events, n_events, sizeof(struct decoded_event), decoded_event_cmp);
 	
-	if (srv < 0) {
-		fuse_reply_err(req, errno);
-		return;
-	} else {
-		size = srv;
+	for (k=0; k < n_events; k++) {
+		desc = events[k].ev.type < EV_MAX ? &event_descs[events[k].ev.type] : 0;
+		name = events[k].ev.id < hdr.n_names ? names + events[k].ev.id * EVENTS_NAME_SIZE : "?";
+		
+		printf("%" PRIu64 ".%09" PRIu64 " %u %s %.*s ",
+			events[k].ev.ts / 1000000000, events[k].ev.ts % 1000000000,
+			events[k].shard, desc ? desc->name : "unknown", EVENTS_NAME_SIZE, name);
+		if (desc)
+			printf(desc->fmt, events[k].ev.a, events[k].ev.b, events[k].ev.c);
+		else
+			printf("%" PRIu32 " %" PRIu64 " %" PRIu64 " %" PRIu64, events[k].ev.type,
+				events[k].ev.a, events[k].ev.b, events[k].ev.c);
+		printf("\n");
 	}
 	
-	fuse_reply_write(req, size);
+	free(events);
+	free(buf);
+	
+	return 0;
 }
 
-// static void sertee_ioctl(fuse_req_t req, int cmd, void *arg,
-// 						  struct fuse_file_info *fi, unsigned flags,
-// 						  const void *in_buf, size_t in_bufsz, size_t out_bufsz)
-// {
-// 	struct sertee_dev *sertee_dev = (struct sertee_dev *) fuse_req_userdata(req);
-// 	
-// 	if (flags & FUSE_IOCTL_COMPAT) {
-// 		fuse_reply_err(req, ENOSYS);
-// 		return;
-// 	}
-// 	
-// 	switch (cmd) {
-// 		default:
-// 			fuse_reply_err(req, EINVAL);
-// 	}
-// }
-
-static void sertee_poll(fuse_req_t req, struct fuse_file_info *fi,
-			  struct fuse_pollhandle *ph)
-{
-	unsigned revents = 0;
-	struct sertee_dev *sertee_dev = (struct sertee_dev *) fuse_req_userdata(req);
-	size_t available;
-	
-	DBG("POLL: %s ph %p old %p ", sertee_dev->name, ph, sertee_dev->poll_handle);
+// reserve the initial buffers of all sources, the rest of the budget is
+// shared by the sources whose readers fall behind
+static int sertee_arena_setup(struct sertee *sertee) {
+	struct sertee_arena *arena;
+	struct sertee_source *source;
+	size_t reserved;
+	unsigned int i;
 	
-	if (ph) {
-		if (sertee_dev->poll_handle)
-			fuse_pollhandle_destroy(sertee_dev->poll_handle);
+	reserved = 0;
+	for (i=0; i < sertee->n_sources; i++) {
+		source = sertee->sources[i];
 		
-		sertee_dev->poll_handle = ph;
+		source->bufsize = arena_round(source->bufsize);
+		source->bufsize_min = source->bufsize;
+		if (source->bufsize_max) {
+			source->bufsize_max = source->bufsize_max / ARENA_CHUNK_SIZE * ARENA_CHUNK_SIZE;
+			if (source->bufsize_max < source->bufsize)
+				source->bufsize_max = source->bufsize;
+		}
+		reserved += source->bufsize;
 	}
 	
-	available = get_avail_data_size(sertee_dev);
+	if (reserved > sertee->memory) {
+		fprintf(stderr, "error, the buffers of the sources need %zu bytes, more than the budget of %zu bytes\n",
+			reserved, sertee->memory);
+		return 1;
+	}
 	
-	DBG("avail %zu\n", available);
+	arena = (struct sertee_arena *) calloc(1, sizeof(struct sertee_arena));
+	if (!arena) {
+		fprintf(stderr, "allocating memory budget failed\n");
+		return 1;
+	}
 	
-	if (available > 0)
-		revents |= POLLIN;
+	pthread_mutex_init(&arena->lock, 0);
+	arena->n_chunks = sertee->memory / ARENA_CHUNK_SIZE;
+	arena->used_map = (uint64_t *) calloc((arena->n_chunks + 63) / 64, sizeof(uint64_t));
 	
-	fuse_reply_poll(req, revents);
-}
-
-static const struct cuse_lowlevel_ops sertee_llops = {
-	.open = sertee_open,
-	.release = sertee_release,
-	.read = sertee_read,
-	.write = sertee_write,
-	.poll = sertee_poll,
-// 	.ioctl = sertee_ioctl,
-};
-
-void source_read(struct sertee *sertee) {
-	int i;
-	ssize_t srv;
-	struct sertee_dev *sertee_dev;
+	// pages are only backed by memory once a ring uses them
+	arena->mem = (char *) mmap(0, arena->n_chunks * ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (arena->mem == MAP_FAILED || !arena->used_map) {
+		fprintf(stderr, "allocating memory budget failed: %s\n", strerror(errno));
+		return 1;
+	}
 	
-	DBG("SOURCE_READ\n");
+	sertee->arena = arena;
 	
-	while (1) {
-		srv = read(sertee->source_fd, sertee->pos, (sertee->buf + sertee->bufsize) - sertee->pos);
-		if (srv < 0) {
-			if (errno == EAGAIN || errno == EINTR)
-				break;
-			
-			fprintf(stderr, "read() from source failed: %s\n", strerror(errno));
-			return;
-		} else
-		if (srv == 0)
-			break;
-		
-		for (i=0; i < sertee->n_devs; i++) {
-			sertee_dev = sertee->devs[i];
-			
-			// if we overtake a device, move its pointer to the oldest data
-			// TODO or reset the pointer?
-			if (sertee->pos < sertee_dev->pos && sertee_dev->pos <= sertee->pos + srv) {
-				sertee_dev->pos = sertee->pos + srv;
-			}
-		}
-		
-		sertee->pos += srv;
-		
-		if (sertee->pos == sertee->buf + sertee->bufsize) {
-			sertee->round += 1;
-			sertee->pos = sertee->buf;
-		}
-		
-		DBG("source read %zd bytes new pos %zd\n", srv, sertee->pos - sertee->buf);
-		
-		for (i=0; i < sertee->n_devs; i++) {
-			sertee_dev = sertee->devs[i];
-			
-			if (sertee_dev->poll_handle && get_avail_data_size(sertee_dev)) {
-				fuse_notify_poll(sertee_dev->poll_handle);
-				fuse_pollhandle_destroy(sertee_dev->poll_handle);
-				sertee_dev->poll_handle = 0;
-			}
-		}
-	}
+	return 0;
 }
 
-#define MAX_EVENTS 5
-
-void sertee_loop(struct sertee *sertee) {
-	int res = 0;
-	struct fuse_buf fbuf = {.mem = NULL, };
-	struct epoll_event event, events[MAX_EVENTS];
-	struct fuse_session *fsess;
+static int sertee_source_setup(struct sertee *sertee, struct sertee_source *source) {
+	int rv;
 	struct sertee_dev *sertee_dev;
+	char *it, *saveit, *buf;
 	
-	int event_count, i, stop;
+	if (sertee->arena)
+		buf = arena_alloc(sertee->arena, source->bufsize);
+	else
+		buf = malloc(source->bufsize);
+	if (!buf) {
+		fprintf(stderr, "allocating buffer for \"%s\" failed\n", source->source_name);
+		return 1;
+	}
+	sertee_ring_init(&source->ring, buf, source->bufsize, 0);
+	source->ring.overrun = dev_overrun;
 	
-	stop = 0;
-	while (!stop) {
-		event_count = epoll_wait(sertee->epoll_fd, events, MAX_EVENTS, 30000);
-		if (event_count < 0)
-			break;
-		
-		for (i=0; i < event_count; i++) {
-			sertee_dev = (struct sertee_dev *) events[i].data.ptr;
-			
-			if (sertee_dev == 0) {
-				source_read(sertee);
-				continue;
-			}
-			
-			res = fuse_session_receive_buf(sertee_dev->fsess, &fbuf);
-			
-			if (res == -EINTR)
-				continue;
-			if (res <= 0) {
-				stop = 1;
-				break;
-			}
-			
-			fuse_session_process_buf(sertee_dev->fsess, &fbuf);
-			
-			if (fuse_session_exited(sertee_dev->fsess)) {
-				stop = 1;
-				break;
-			}
-		}
+	pthread_mutex_init(&source->clients_lock, 0);
+	
+	// chunks are at least one byte but usually much larger
+	source->n_chunks = source->bufsize / 8 > 256 ? source->bufsize / 8 : 256;
+	source->chunks = (struct ts_chunk *) calloc(source->n_chunks, sizeof(struct ts_chunk));
+	if (!source->chunks) {
+		fprintf(stderr, "allocating chunk index for \"%s\" failed\n", source->source_name);
+		return 1;
 	}
 	
-	free(fbuf.mem);
-}
-
-static int sertee_lowlevel_main(int argc, char *argv[],
-								struct sertee *sertee, struct sertee_dev *sertee_dev)
-{
-	int multithreaded;
-	int res;
+	source->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (source->timer_fd == -1) {
+		fprintf(stderr, "timerfd_create failed: %s\n", strerror(errno));
+		return 1;
+	}
+	source->timer_type = SERTEE_OBJ_SOURCE_TIMER;
+	source->timer_eevent.events = EPOLLIN;
+	source->timer_eevent.data.ptr = &source->timer_type;
 	
-	sertee_dev->fsess = cuse_lowlevel_setup(argc, argv, &sertee_dev->ci, &sertee_llops, &multithreaded, sertee_dev);
-	if (sertee_dev->fsess == NULL)
+	if (epoll_ctl(source->shard->epoll_fd, EPOLL_CTL_ADD, source->timer_fd, &source->timer_eevent)) {
+		fprintf(stderr, "epoll_ctl(timer) failed\n");
 		return 1;
+	}
 	
-	if (multithreaded) {
-		fprintf(stdout, "multithreading not supported\n");
+	source->flush_timer.fn = source_flush_timeout;
+	source->reconnect_timer.fn = source_reconnect;
+	
+	// a source that never sends anything stalls as well
+	source->stats.last_rx = sertee_now();
+	source->liveness_timer.fn = source_liveness_tick;
+	sertee_timer_add(source, &source->liveness_timer, 1000000000ULL);
+	
+	rv = source_open(source);
+	if (rv) {
+		fprintf(stderr, "opening source \"%s\" failed: %s\n", source->source_name, strerror(rv));
+		return rv;
 	}
 	
-	sertee_dev->eevent.events = EPOLLIN;
-	sertee_dev->eevent.data.ptr = sertee_dev;
-
-	if (epoll_ctl(sertee->epoll_fd, EPOLL_CTL_ADD, fuse_session_fd(sertee_dev->fsess), &sertee_dev->eevent)) {
-		fprintf(stderr, "epoll_ctl failed\n");
+	if (source->monitor_name && sertee_monitor_setup(sertee, source))
 		return 1;
+	
+	it = strtok_r(source->dev_names, ",", &saveit);
+	while (it != NULL) {
+		source->n_devs += 1;
+		source->devs = (struct sertee_dev **) realloc(source->devs, sizeof(void *) * source->n_devs);
+		
+		source->devs[source->n_devs-1] = (struct sertee_dev*) sertee_zalloc(sizeof(struct sertee_dev));
+		sertee_dev = source->devs[source->n_devs-1];
+		if (!sertee_dev)
+			return 1;
+		
+		pthread_mutex_init(&sertee_dev->handles_lock, 0);
+		
+		sertee_dev->type = SERTEE_OBJ_DEV;
+		sertee_dev->source = source;
+		
+		rv = asprintf(&sertee_dev->name, "DEVNAME=%s", it);
+		if (rv < 0) {
+			fprintf(stderr, "asprintf() failed: %d\n", rv);
+			return rv;
+		}
+		sertee_dev->dev_name = sertee_dev->name + strlen("DEVNAME=");
+		
+		sertee_dev->dev_info_argv[0] = sertee_dev->name;
+		
+		sertee_dev->ci.dev_info_argc = 1;
+		sertee_dev->ci.dev_info_argv = &sertee_dev->dev_info_argv[0];
+		sertee_dev->ci.flags = CUSE_UNRESTRICTED_IOCTL;
+		
+		sertee_dev->fsess = sertee_lowlevel_main(sertee->args->argc, sertee->args->argv,
+					&sertee_dev->ci, &sertee_llops, sertee_dev, source->shard, &sertee_dev->eevent);
+		if (!sertee_dev->fsess)
+			return 1;
+		
+		if (source->timestamps && sertee_tsdev_setup(sertee, sertee_dev))
+			return 1;
+		
+		it = strtok_r(NULL, ",", &saveit);
 	}
 	
 	return 0;
@@ -405,16 +6194,23 @@ static int sertee_lowlevel_main(int argc, char *argv[],
 
 int main(int argc, char **argv) {
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
-	int rv, i;
-	struct sertee_dev *sertee_dev;
+	int rv, i, j;
+	struct sertee_source *source;
+	struct capture_batch *batch;
 	struct sertee sertee;
-	char *it, *saveit, *dev_name;
 	
 	
 	memset(&sertee, 0, sizeof(struct sertee));
 	
-	sertee.bufsize = DEFAULT_BUFSIZE;
+	sertee.args = &args;
+	sertee.capture_fd = -1;
+	sertee.rebalance_interval = DEFAULT_REBALANCE_INTERVAL;
+	sertee.events_size = DEFAULT_EVENTS_SIZE;
+	sertee.pool_cache = DEFAULT_POOL_CACHE;
+	sertee_source_init(&sertee, &sertee.cli_source);
 	rv = fuse_opt_parse(&args, &sertee, sertee_opts, sertee_process_arg);
+	if (rv == 0)
+		rv = fuse_opt_parse(&args, &sertee.cli_source, sertee_source_opts, sertee_source_process_arg);
 	if (rv) {
 		fprintf(stderr, "fuse_opt_parse failed: %d\n", rv);
 		return rv;
@@ -426,84 +6222,167 @@ int main(int argc, char **argv) {
 		return 0;
 	}
 	
-	if (!sertee.dev_names) {
-		fprintf(stderr, "error, device names required\n");
-		
+	if (sertee.decode_events) {
+		rv = sertee_decode_events(sertee.decode_events);
 		fuse_opt_free_args(&args);
 		
-		return 1;
+		return rv;
 	}
-	if (!sertee.source_name) {
-		fprintf(stderr, "error, source name required\n");
+	
+	// the command line describes a source group unless a config is used
+	if (!sertee.config || sertee.cli_source.dev_names || sertee.cli_source.source_name) {
+		source = sertee_source_new(&sertee, &sertee.cli_source);
+		if (!source) {
+			fuse_opt_free_args(&args);
+			
+			return 1;
+		}
 		
+		rv = sertee_add_source(&sertee, source);
+		if (rv) {
+			fuse_opt_free_args(&args);
+			
+			return rv;
+		}
+	}
+	
+	if (sertee.config) {
+		rv = sertee_read_config(&sertee, sertee.config);
+		if (rv) {
+			fuse_opt_free_args(&args);
+			
+			return rv;
+		}
+	}
+	
+	rv = sertee_setup_shards(&sertee);
+	if (rv) {
 		fuse_opt_free_args(&args);
 		
-		return 1;
+		return rv;
 	}
 	
-	sertee.buf = malloc(sertee.bufsize);
-	sertee.pos = sertee.buf;
+	if (sertee.capture) {
+		rv = sertee_capture_setup(&sertee);
+		if (rv) {
+			fuse_opt_free_args(&args);
+			
+			return rv;
+		}
+	}
 	
-	sertee.epoll_fd = epoll_create1(0);
-	if (sertee.epoll_fd == -1) {
-		fprintf(stderr, "epoll_create1 failed\n");
-		return 1;
+	if (sertee.memory) {
+		rv = sertee_arena_setup(&sertee);
+		if (rv) {
+			fuse_opt_free_args(&args);
+			
+			return rv;
+		}
 	}
 	
-	sertee.source_fd = open(sertee.source_name, O_RDWR | O_NOCTTY | O_SYNC | O_NONBLOCK);
-	if (sertee.source_fd == -1) {
-		fprintf(stderr, "opening source \"%s\" failed: %s\n", sertee.source_name, strerror(errno));
-		return errno;
+	for (i=0; i < sertee.n_sources; i++) {
+		rv = sertee_source_setup(&sertee, sertee.sources[i]);
+		if (rv)
+			break;
 	}
-	sertee.source_eevent.events = EPOLLIN;
-	sertee.source_eevent.data.ptr = 0;
 	
-	if (epoll_ctl(sertee.epoll_fd, EPOLL_CTL_ADD, sertee.source_fd, &sertee.source_eevent)) {
-		fprintf(stderr, "epoll_ctl(source) failed\n");
-		return 1;
+	for (i=0; rv == 0 && i < sertee.n_broadcasts; i++)
+		rv = sertee_broadcast_setup(&sertee, sertee.broadcasts[i]);
+	
+	if (rv == 0 && sertee.stats_name)
+		rv = sertee_stats_setup(&sertee);
+	
+	if (rv == 0 && sertee.metrics_addr)
+		rv = sertee_metrics_setup(&sertee);
+	
+	if (rv == 0 && (sertee.alarm_name || sertee.alarm_exec))
+		rv = sertee_alarm_setup(&sertee);
+	
+	if (rv == 0 && sertee.events)
+		rv = sertee_events_setup(&sertee);
+	
+	if (rv == 0) {
+		if (sertee.n_shards == 1) {
+			sertee_loop(&sertee.shards[0]);
+		} else {
+			rv = sertee_start_shards(&sertee);
+			if (rv == 0)
+				sertee_supervise(&sertee);
+			
+			for (i=0; i < sertee.n_shards; i++) {
+				if (sertee.shards[i].thread)
+					pthread_join(sertee.shards[i].thread, 0);
+			}
+		}
 	}
 	
-	it = strtok_r(sertee.dev_names, ",", &saveit);
-	while (it != NULL) {
-		sertee.n_devs += 1;
-		sertee.devs = (struct sertee_dev **) realloc(sertee.devs, sizeof(void *) * sertee.n_devs);
-		
-		sertee.devs[sertee.n_devs-1] = (struct sertee_dev*) calloc(1, sizeof(struct sertee_dev));
-		sertee_dev = sertee.devs[sertee.n_devs-1];
-		
-		sertee_dev->sertee = &sertee;
-		
-		DBG("creating dev \"%s\" (%p)\n", it, sertee_dev);
+	if (sertee.capture_thread) {
+		// stop the capture thread once the shards flushed their batches. The
+		// pipe has room as it holds far more than all batches together.
+		batch = 0;
+		if (write(sertee.capture_fds[1], &batch, sizeof(batch)) == sizeof(batch))
+			pthread_join(sertee.capture_thread, 0);
+		close(sertee.capture_fd);
+	}
+	
+	for (i=0; i < sertee.n_sources; i++) {
+		source = sertee.sources[i];
 		
-		rv = asprintf(&sertee_dev->name, "DEVNAME=%s", it);
-		if (rv < 0) {
-			fprintf(stderr, "asprintf() failed: %d\n", rv);
-			return rv;
+		for (j=0; j < source->n_devs; j++) {
+			if (!source->devs[j]->fsess)
+				continue;
+			
+			fuse_session_reset(source->devs[j]->fsess);
+			cuse_lowlevel_teardown(source->devs[j]->fsess);
+			
+			if (source->devs[j]->tsdev) {
+				fuse_session_reset(source->devs[j]->tsdev->fsess);
+				cuse_lowlevel_teardown(source->devs[j]->tsdev->fsess);
+			}
 		}
 		
-		sertee_dev->dev_info_argv[0] = sertee_dev->name;
-		
-		sertee_dev->ci.dev_info_argc = 1;
-		sertee_dev->ci.dev_info_argv = &sertee_dev->dev_info_argv[0];
-// 		sertee_dev->ci.flags = CUSE_UNRESTRICTED_IOCTL;
-		
-		rv = sertee_lowlevel_main(args.argc, args.argv, &sertee, sertee_dev);
-		if (rv)
-			break;
+		if (source->monitor) {
+			fuse_session_reset(source->monitor->fsess);
+			cuse_lowlevel_teardown(source->monitor->fsess);
+		}
+	}
+	
+	for (i=0; i < sertee.n_broadcasts; i++) {
+		if (!sertee.broadcasts[i]->fsess)
+			continue;
 		
-		it = strtok_r(NULL, ",", &saveit);
+		fuse_session_reset(sertee.broadcasts[i]->fsess);
+		cuse_lowlevel_teardown(sertee.broadcasts[i]->fsess);
 	}
 	
-	sertee_loop(&sertee);
+	if (sertee.statsdev) {
+		fuse_session_reset(sertee.statsdev->fsess);
+		cuse_lowlevel_teardown(sertee.statsdev->fsess);
+	}
 	
-	for (i=0; i < sertee.n_devs; i++) {
-		fuse_session_reset(sertee.devs[i]->fsess);
-		cuse_lowlevel_teardown(sertee.devs[i]->fsess);
+	if (sertee.alarmdev) {
+		fuse_session_reset(sertee.alarmdev->fsess);
+		cuse_lowlevel_teardown(sertee.alarmdev->fsess);
 	}
 	
-	if (close(sertee.epoll_fd)) {
-		fprintf(stderr, "close epoll_fd failed\n");
-		rv = 1;
+	if (sertee.metrics) {
+		for (i=0; i < METRICS_MAX_CONNS; i++)
+			metrics_close(&sertee.metrics->conns[i]);
+		close(sertee.metrics->fd);
+		if (!strncmp(sertee.metrics_addr, "unix:", 5))
+			unlink(sertee.metrics_addr + 5);
+	}
+	
+	if (sertee.events_map) {
+		sertee_events_on = 0;
+		munmap(sertee.events_map, sertee.events_map_size);
+	}
+	
+	for (i=0; i < sertee.n_shards; i++) {
+		if (close(sertee.shards[i].epoll_fd)) {
+			fprintf(stderr, "close epoll_fd failed\n");
+			rv = 1;
+		}
 	}
 	
 	fuse_opt_free_args(&args);
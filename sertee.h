@@ -0,0 +1,47 @@
+/*
+ * sertee
+ * ----------
+ *
+ * ioctls that are supported by the devices of sertee in addition to the
+ * usual terminal ioctls
+ *
+ * License: MPL-2.0
+ */
+
+#ifndef SERTEE_H
+#define SERTEE_H
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+// offsets are absolute positions in the stream of the source
+struct sertee_offsets {
+	// position of the next byte this device will return
+	uint64_t read;
+	// position of the next byte that will be read from the source
+	uint64_t head;
+	// oldest position that is still buffered
+	uint64_t oldest;
+};
+
+struct sertee_lag {
+	// number of bytes that can be read without blocking
+	uint64_t lag;
+	// number of bytes that were overwritten before they were read
+	uint64_t lost;
+	// number of times the source overtook this device
+	uint64_t overruns;
+};
+
+#define SERTEE_IOC_MAGIC 'S'
+
+#define SERTEE_IOC_GET_OFFSETS _IOR(SERTEE_IOC_MAGIC, 1, struct sertee_offsets)
+#define SERTEE_IOC_GET_LAG _IOR(SERTEE_IOC_MAGIC, 2, struct sertee_lag)
+// poll() only signals POLLIN if at least this many bytes are available
+#define SERTEE_IOC_SET_LOWAT _IOW(SERTEE_IOC_MAGIC, 3, uint32_t)
+// skip all unread data
+#define SERTEE_IOC_SEEK_HEAD _IO(SERTEE_IOC_MAGIC, 4)
+// continue reading at the given offset, it is limited to the buffered data
+#define SERTEE_IOC_SEEK _IOW(SERTEE_IOC_MAGIC, 5, uint64_t)
+
+#endif